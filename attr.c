@@ -0,0 +1,1157 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2019 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+static uint32_t hash_bytes(uint32_t hash, const char *str, size_t len)
+{
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char) str[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+static uint32_t hash_attr(uint32_t device, const char *channel,
+			  size_t channel_len, bool ch_out, const char *attr,
+			  size_t attr_len, enum iio_attr_type type)
+{
+	uint32_t hash = 2166136261u;
+	char key[3];
+
+	key[0] = (char) device;
+	key[1] = (char) (channel ? 2 + ch_out : 0);
+	key[2] = (char) type;
+
+	hash = hash_bytes(hash, key, sizeof(key));
+	if (channel)
+		hash = hash_bytes(hash, channel, channel_len);
+
+	return hash_bytes(hash, attr, attr_len);
+}
+
+static uint32_t hash_name(const char *name, size_t len)
+{
+	return hash_bytes(2166136261u, name, len);
+}
+
+static bool str_equal(const char *str, size_t len, const char *name)
+{
+	return !strncmp(str, name, len) && name[len] == '\0';
+}
+
+/* Find the value of key within the tag [tag, end), as in key="value" */
+static const char * xml_get(const char *tag, const char *end,
+			    const char *key, size_t *len)
+{
+	size_t key_len = strlen(key);
+	const char *ptr, *value;
+
+	for (ptr = tag; ptr + key_len + 3 < end; ptr++) {
+		if (ptr[0] != ' ' || strncmp(ptr + 1, key, key_len) ||
+		    ptr[key_len + 1] != '=' || ptr[key_len + 2] != '"')
+			continue;
+
+		value = ptr + key_len + 3;
+		for (ptr = value; ptr < end && *ptr != '"'; ptr++);
+		*len = (size_t) (ptr - value);
+
+		return value;
+	}
+
+	*len = 0;
+
+	return NULL;
+}
+
+static bool tag_is(const char *tag, size_t len, const char *name)
+{
+	return len == strlen(name) && !strncmp(tag, name, len);
+}
+
+/* Walk the context XML, counting what it describes or, when reg->attrs is
+ * set, filling the tables */
+static void registry_parse(struct tinyiiod_registry *reg, const char *xml)
+{
+	struct tinyiiod_reg_attr *attr;
+	const char *channel = NULL, *name, *tag, *end;
+	size_t channel_len = 0, len;
+	bool ch_out = false;
+	enum iio_attr_type type;
+
+	reg->num_devices = 0;
+	reg->num_attrs = 0;
+	reg->num_cached = 0;
+
+	for (tag = strchr(xml, '<'); tag; tag = strchr(end, '<')) {
+		tag++;
+		end = strchr(tag, '>');
+		if (!end)
+			break;
+
+		/* Tag name, including the '/' of a closing tag */
+		for (len = 1; tag + len < end && tag[len] != ' ' &&
+		     tag[len] != '/'; len++);
+
+		if (tag_is(tag, len, "device")) {
+			if (reg->devices) {
+				struct tinyiiod_reg_device *dev =
+						&reg->devices[reg->num_devices];
+
+				dev->id = xml_get(tag, end, "id", &dev->id_len);
+				dev->name = xml_get(tag, end, "name",
+						    &dev->name_len);
+			}
+			reg->num_devices++;
+			continue;
+		}
+
+		if (tag_is(tag, len, "channel")) {
+			size_t type_len;
+			const char *ch_type = xml_get(tag, end, "type", &type_len);
+
+			channel = xml_get(tag, end, "id", &channel_len);
+			ch_out = ch_type && type_len == sizeof("output") - 1 &&
+				 !strncmp(ch_type, "output", type_len);
+			if (end[-1] == '/')
+				channel = NULL;
+			continue;
+		}
+
+		if (tag_is(tag, len, "/channel")) {
+			channel = NULL;
+			continue;
+		}
+
+		if (!reg->num_devices)
+			continue;
+
+		if (tag_is(tag, len, "attribute"))
+			type = IIO_ATTR_TYPE_DEVICE;
+		else if (tag_is(tag, len, "debug-attribute"))
+			type = IIO_ATTR_TYPE_DEBUG;
+		else if (tag_is(tag, len, "buffer-attribute"))
+			type = IIO_ATTR_TYPE_BUFFER;
+		else
+			continue;
+
+		name = xml_get(tag, end, "name", &len);
+		if (!name)
+			continue;
+
+		if (reg->attrs) {
+			attr = &reg->attrs[reg->num_attrs];
+			attr->device = reg->num_devices - 1;
+			attr->channel = type == IIO_ATTR_TYPE_DEVICE ? channel : NULL;
+			attr->channel_len = attr->channel ? channel_len : 0;
+			attr->ch_out = attr->channel && ch_out;
+			attr->type = type;
+			attr->name = name;
+			attr->name_len = len;
+		}
+		reg->num_attrs++;
+	}
+}
+
+static void registry_free(struct tinyiiod *iiod, struct tinyiiod_registry *reg)
+{
+	tinyiiod_free(iiod->root, reg->devices);
+	tinyiiod_free(iiod->root, reg->attrs);
+	tinyiiod_free(iiod->root, reg->refs);
+	tinyiiod_free(iiod->root, reg->table);
+	tinyiiod_free(iiod->root, reg->dev_table);
+	memset(reg, 0, sizeof(*reg));
+}
+
+static void * registry_alloc(struct tinyiiod *iiod, size_t size)
+{
+	void *ptr = tinyiiod_malloc(iiod->root, size);
+
+	if (ptr)
+		memset(ptr, 0, size);
+
+	return ptr;
+}
+
+/* Keep the tables at most half full */
+static size_t table_size(size_t entries)
+{
+	size_t size;
+
+	for (size = 4; size < 2 * entries;)
+		size <<= 1;
+
+	return size;
+}
+
+static void table_insert(uint32_t *table, size_t size, uint32_t slot,
+			 uint32_t value)
+{
+	for (slot &= size - 1; table[slot]; slot = (slot + 1) & (size - 1));
+	table[slot] = value;
+}
+
+/* Allocate the hash tables, and fill the one of the devices */
+static int32_t registry_alloc_tables(struct tinyiiod_registry *reg,
+				     struct tinyiiod *iiod)
+{
+	const struct tinyiiod_device_desc *desc;
+	struct tinyiiod_reg_device *dev;
+	uint32_t i;
+
+	reg->table_size = table_size(reg->num_attrs);
+	reg->dev_table_size = table_size(2 * reg->num_devices);
+
+	reg->table = registry_alloc(iiod, reg->table_size * sizeof(*reg->table));
+	reg->dev_table = registry_alloc(iiod, reg->dev_table_size *
+					sizeof(*reg->dev_table));
+	if (!reg->table || !reg->dev_table)
+		return -ENOMEM;
+
+	/* Inserted in order, so that the first device of a name is found */
+	for (i = 0; i < reg->num_devices; i++) {
+		if (reg->context) {
+			desc = &reg->context->devices[i];
+			table_insert(reg->dev_table, reg->dev_table_size,
+				     hash_name(desc->id, strlen(desc->id)),
+				     i + 1);
+			if (desc->name)
+				table_insert(reg->dev_table,
+					     reg->dev_table_size,
+					     hash_name(desc->name,
+						       strlen(desc->name)),
+					     i + 1);
+			continue;
+		}
+
+		dev = &reg->devices[i];
+		if (dev->id)
+			table_insert(reg->dev_table, reg->dev_table_size,
+				     hash_name(dev->id, dev->id_len), i + 1);
+		if (dev->name)
+			table_insert(reg->dev_table, reg->dev_table_size,
+				     hash_name(dev->name, dev->name_len), i + 1);
+	}
+
+	return 0;
+}
+
+static int32_t registry_build(struct tinyiiod_registry *reg,
+			      struct tinyiiod *iiod)
+{
+	struct tinyiiod_reg_attr *attr;
+	uint32_t i;
+
+	registry_parse(reg, iiod->root->xml);
+	if (!reg->num_devices)
+		return -ENOENT;
+
+	reg->devices = registry_alloc(iiod, reg->num_devices *
+				      sizeof(*reg->devices));
+	reg->attrs = registry_alloc(iiod, (reg->num_attrs + 1) *
+				    sizeof(*reg->attrs));
+	if (!reg->devices || !reg->attrs) {
+		registry_free(iiod, reg);
+		return -ENOMEM;
+	}
+
+	registry_parse(reg, iiod->root->xml);
+
+	if (registry_alloc_tables(reg, iiod) < 0) {
+		registry_free(iiod, reg);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < reg->num_attrs; i++) {
+		attr = &reg->attrs[i];
+		table_insert(reg->table, reg->table_size,
+			     hash_attr(attr->device, attr->channel,
+				       attr->channel_len, attr->ch_out,
+				       attr->name, attr->name_len, attr->type),
+			     i + 1);
+	}
+
+	return 0;
+}
+
+/* Key of an attribute of a context descriptor, the kind of channel
+ * attributes being ignored */
+static uint32_t hash_ref(const struct tinyiiod_registry *reg,
+			 const struct tinyiiod_desc_ref *ref)
+{
+	uint32_t device = (uint32_t) (ref->dev - reg->context->devices);
+	const char *name = ref->attr->name;
+
+	if (!ref->channel)
+		return hash_attr(device, NULL, 0, false, name, strlen(name),
+				 ref->attr->type);
+
+	return hash_attr(device, ref->channel->id, strlen(ref->channel->id),
+			 ref->channel->output, name, strlen(name),
+			 IIO_ATTR_TYPE_DEVICE);
+}
+
+static void registry_add_refs(struct tinyiiod_registry *reg,
+			      const struct tinyiiod_device_desc *dev,
+			      const struct tinyiiod_channel_desc *channel,
+			      const struct tinyiiod_attr_desc *attrs,
+			      size_t num_attrs)
+{
+	struct tinyiiod_desc_ref *ref;
+	size_t i;
+
+	for (i = 0; i < num_attrs; i++) {
+		ref = &reg->refs[reg->num_attrs];
+		ref->dev = dev;
+		ref->channel = channel;
+		ref->attr = &attrs[i];
+		reg->num_attrs++;
+
+		table_insert(reg->table, reg->table_size, hash_ref(reg, ref),
+			     (uint32_t) reg->num_attrs);
+	}
+}
+
+/* Index the attributes of a context descriptor by pointing into it, in
+ * the order they are walked in so that the first of a name is found */
+static int32_t registry_build_desc(struct tinyiiod_registry *reg,
+				   struct tinyiiod *iiod)
+{
+	const struct tinyiiod_context_desc *ctx = iiod->ops->context;
+	const struct tinyiiod_device_desc *dev;
+	size_t i, j, num_attrs = 0;
+
+	if (!ctx->num_devices)
+		return -ENOENT;
+
+	for (i = 0; i < ctx->num_devices; i++) {
+		dev = &ctx->devices[i];
+		num_attrs += dev->num_attrs;
+		for (j = 0; j < dev->num_channels; j++)
+			num_attrs += dev->channels[j].num_attrs;
+	}
+
+	reg->context = ctx;
+	reg->num_devices = ctx->num_devices;
+	reg->num_attrs = num_attrs;
+	reg->refs = registry_alloc(iiod, (num_attrs + 1) * sizeof(*reg->refs));
+	if (!reg->refs || registry_alloc_tables(reg, iiod) < 0) {
+		registry_free(iiod, reg);
+		return -ENOMEM;
+	}
+
+	reg->num_attrs = 0;
+	for (i = 0; i < ctx->num_devices; i++) {
+		dev = &ctx->devices[i];
+		for (j = 0; j < dev->num_channels; j++)
+			registry_add_refs(reg, dev, &dev->channels[j],
+					  dev->channels[j].attrs,
+					  dev->channels[j].num_attrs);
+		registry_add_refs(reg, dev, NULL, dev->attrs, dev->num_attrs);
+	}
+
+	return 0;
+}
+
+/* Only built by the thread servicing the clients, which tinyiiod_call()
+ * makes sure of before the worker looks attributes up; the worker only
+ * sees it once complete */
+int32_t tinyiiod_get_registry(struct tinyiiod *iiod)
+{
+	struct tinyiiod_registry *reg = &iiod->root->registry;
+	struct tinyiiod_registry built;
+	int32_t ret;
+
+	if (reg->table)
+		return 0;
+
+	memset(&built, 0, sizeof(built));
+	if (iiod->ops->context) {
+		ret = registry_build_desc(&built, iiod);
+	} else {
+		ret = tinyiiod_get_xml(iiod);
+		if (ret >= 0)
+			ret = registry_build(&built, iiod);
+	}
+	if (ret < 0)
+		return ret;
+
+	tinyiiod_lock(iiod);
+	*reg = built;
+	tinyiiod_unlock(iiod);
+
+	return 0;
+}
+
+/* The registry as it is, with the lock held */
+static struct tinyiiod_registry * registry_built(struct tinyiiod *iiod)
+{
+	struct tinyiiod_registry *reg = &iiod->root->registry;
+
+	return reg->table ? reg : NULL;
+}
+
+/* Freed once the worker cannot see it any more */
+void tinyiiod_free_registry(struct tinyiiod *iiod)
+{
+	struct tinyiiod *root = iiod->root;
+	struct tinyiiod_registry reg;
+
+	tinyiiod_lock(iiod);
+	reg = root->registry;
+	memset(&root->registry, 0, sizeof(root->registry));
+	memset(root->cache, 0, sizeof(root->cache));
+	tinyiiod_unlock(iiod);
+
+	registry_free(iiod, &reg);
+}
+
+static bool registry_device_is(const struct tinyiiod_registry *reg,
+			       uint32_t i, const char *device)
+{
+	const struct tinyiiod_device_desc *desc;
+	const struct tinyiiod_reg_device *dev;
+
+	if (reg->context) {
+		desc = &reg->context->devices[i];
+		return !strcmp(desc->id, device) ||
+			(desc->name && !strcmp(desc->name, device));
+	}
+
+	dev = &reg->devices[i];
+	return (dev->id && str_equal(dev->id, dev->id_len, device)) ||
+		(dev->name && str_equal(dev->name, dev->name_len, device));
+}
+
+static int32_t registry_find_device(struct tinyiiod_registry *reg,
+				    const char *device)
+{
+	uint32_t slot = hash_name(device, strlen(device));
+	size_t mask = reg->dev_table_size - 1;
+
+	for (slot &= mask; reg->dev_table[slot]; slot = (slot + 1) & mask) {
+		if (registry_device_is(reg, reg->dev_table[slot] - 1, device))
+			return (int32_t) (reg->dev_table[slot] - 1);
+	}
+
+	return -ENODEV;
+}
+
+static int32_t registry_next_attr(struct tinyiiod_registry *reg, int32_t id,
+				  uint32_t device, const char *channel,
+				  bool ch_out, enum iio_attr_type type)
+{
+	size_t channel_len = channel ? strlen(channel) : 0;
+	struct tinyiiod_reg_attr *entry;
+	uint32_t i;
+
+	for (i = (uint32_t) (id + 1); i < reg->num_attrs; i++) {
+		entry = &reg->attrs[i];
+
+		if (entry->device != device || !entry->channel != !channel)
+			continue;
+
+		if (channel) {
+			if (entry->ch_out == ch_out &&
+			    entry->channel_len == channel_len &&
+			    !strncmp(entry->channel, channel, channel_len))
+				return (int32_t) i;
+		} else if (entry->type == type) {
+			return (int32_t) i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static int32_t registry_lookup(struct tinyiiod_registry *reg,
+			       const char *device, const char *channel,
+			       bool ch_out, const char *attr,
+			       enum iio_attr_type type)
+{
+	size_t channel_len = channel ? strlen(channel) : 0;
+	size_t attr_len = strlen(attr);
+	struct tinyiiod_reg_attr *entry;
+	uint32_t slot;
+	int32_t dev;
+
+	dev = registry_find_device(reg, device);
+	if (dev < 0)
+		return dev;
+
+	if (channel)
+		type = IIO_ATTR_TYPE_DEVICE;
+
+	slot = hash_attr((uint32_t) dev, channel, channel_len, ch_out,
+			 attr, attr_len, type);
+
+	for (slot &= reg->table_size - 1; reg->table[slot];
+	     slot = (slot + 1) & (reg->table_size - 1)) {
+		entry = &reg->attrs[reg->table[slot] - 1];
+
+		if (entry->device != (uint32_t) dev || entry->type != type ||
+		    !entry->channel != !channel ||
+		    entry->name_len != attr_len ||
+		    strncmp(entry->name, attr, attr_len))
+			continue;
+
+		if (channel && (entry->ch_out != ch_out ||
+				entry->channel_len != channel_len ||
+				strncmp(entry->channel, channel, channel_len)))
+			continue;
+
+		return (int32_t) (reg->table[slot] - 1);
+	}
+
+	return -ENOENT;
+}
+
+/* Attribute of the registry of a context descriptor */
+static int32_t registry_lookup_desc(struct tinyiiod_registry *reg,
+				    const char *device, const char *channel,
+				    bool ch_out, const char *attr,
+				    enum iio_attr_type type,
+				    const struct tinyiiod_desc_ref **found)
+{
+	const struct tinyiiod_desc_ref *ref;
+	uint32_t slot;
+	int32_t dev;
+
+	dev = registry_find_device(reg, device);
+	if (dev < 0)
+		return dev;
+
+	if (channel)
+		type = IIO_ATTR_TYPE_DEVICE;
+
+	slot = hash_attr((uint32_t) dev, channel, channel ? strlen(channel) : 0,
+			 ch_out, attr, strlen(attr), type);
+
+	for (slot &= reg->table_size - 1; reg->table[slot];
+	     slot = (slot + 1) & (reg->table_size - 1)) {
+		ref = &reg->refs[reg->table[slot] - 1];
+
+		if (ref->dev != &reg->context->devices[dev] ||
+		    !ref->channel != !channel || strcmp(ref->attr->name, attr))
+			continue;
+
+		if (channel ? ref->channel->output != ch_out ||
+			      strcmp(ref->channel->id, channel) :
+			      ref->attr->type != type)
+			continue;
+
+		*found = ref;
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+static const struct tinyiiod_device_desc * desc_find_device(
+		const struct tinyiiod_context_desc *ctx, const char *device)
+{
+	const struct tinyiiod_device_desc *dev;
+	size_t i;
+
+	for (i = 0; i < ctx->num_devices; i++) {
+		dev = &ctx->devices[i];
+
+		if (!strcmp(dev->id, device) ||
+		    (dev->name && !strcmp(dev->name, device)))
+			return dev;
+	}
+
+	return NULL;
+}
+
+/* Attributes of the device, or of its channel, walked in place when there
+ * is no registry to look them up in */
+static int32_t desc_find_attrs(const struct tinyiiod_context_desc *ctx,
+			       const char *device, const char *channel,
+			       bool ch_out,
+			       const struct tinyiiod_device_desc **dev,
+			       const struct tinyiiod_channel_desc **ch,
+			       const struct tinyiiod_attr_desc **attrs,
+			       size_t *num_attrs)
+{
+	size_t i;
+
+	*dev = desc_find_device(ctx, device);
+	if (!*dev)
+		return -ENODEV;
+
+	*ch = NULL;
+	if (!channel) {
+		*attrs = (*dev)->attrs;
+		*num_attrs = (*dev)->num_attrs;
+		return 0;
+	}
+
+	for (i = 0; i < (*dev)->num_channels; i++) {
+		*ch = &(*dev)->channels[i];
+
+		if ((*ch)->output == ch_out && !strcmp((*ch)->id, channel)) {
+			*attrs = (*ch)->attrs;
+			*num_attrs = (*ch)->num_attrs;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* Looked up in the registry, or walked without one, e.g. when there is no
+ * memory for it; with the lock held */
+static int32_t desc_find(struct tinyiiod *iiod,
+			 const char *device, const char *channel, bool ch_out,
+			 const char *attr, enum iio_attr_type type,
+			 const struct tinyiiod_device_desc **dev,
+			 const struct tinyiiod_channel_desc **ch,
+			 const struct tinyiiod_attr_desc **desc)
+{
+	struct tinyiiod_registry *reg = registry_built(iiod);
+	const struct tinyiiod_attr_desc *attrs;
+	const struct tinyiiod_desc_ref *ref;
+	size_t i, num_attrs;
+	int32_t ret;
+
+	if (reg) {
+		ret = registry_lookup_desc(reg, device, channel, ch_out, attr,
+					   type, &ref);
+		if (ret < 0)
+			return ret;
+
+		*dev = ref->dev;
+		*ch = ref->channel;
+		*desc = ref->attr;
+		return 0;
+	}
+
+	ret = desc_find_attrs(iiod->ops->context, device, channel, ch_out,
+			      dev, ch, &attrs, &num_attrs);
+	if (ret < 0)
+		return ret;
+
+	/* The kind of channel attributes is ignored */
+	for (i = 0; i < num_attrs; i++) {
+		if (!strcmp(attrs[i].name, attr) &&
+		    (channel || attrs[i].type == type)) {
+			*desc = &attrs[i];
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* Same as tinyiiod_next_attr_name(), id being the index of the attribute
+ * in its table */
+static int32_t desc_next_attr(const struct tinyiiod_context_desc *ctx,
+			      int32_t id, const char *device,
+			      const char *channel, bool ch_out,
+			      enum iio_attr_type type, char *name, size_t len)
+{
+	const struct tinyiiod_device_desc *dev;
+	const struct tinyiiod_channel_desc *ch;
+	const struct tinyiiod_attr_desc *attrs;
+	size_t i, num_attrs;
+	int32_t ret;
+
+	ret = desc_find_attrs(ctx, device, channel, ch_out, &dev, &ch,
+			      &attrs, &num_attrs);
+	if (ret < 0)
+		return ret;
+
+	for (i = (size_t) (id + 1); i < num_attrs; i++) {
+		if (!channel && attrs[i].type != type)
+			continue;
+
+		if (strlen(attrs[i].name) < len)
+			strcpy(name, attrs[i].name);
+		else
+			name[0] = '\0';
+
+		return (int32_t) i;
+	}
+
+	return -ENOENT;
+}
+
+int32_t tinyiiod_attr_id(struct tinyiiod *iiod, const char *device,
+			 const char *channel, bool ch_out, const char *attr,
+			 enum iio_attr_type type)
+{
+	int32_t ret;
+
+	if (iiod->ops->context)
+		return -ENOSYS;
+
+	ret = tinyiiod_get_registry(iiod);
+	if (ret < 0)
+		return ret;
+
+	return tinyiiod_lookup_attr(iiod, device, channel, ch_out, attr, type);
+}
+
+int32_t tinyiiod_lookup_attr(struct tinyiiod *iiod, const char *device,
+			     const char *channel, bool ch_out, const char *attr,
+			     enum iio_attr_type type)
+{
+	struct tinyiiod_registry *reg;
+	int32_t id = -ENOENT;
+
+	tinyiiod_lock(iiod);
+	reg = registry_built(iiod);
+	if (reg)
+		id = registry_lookup(reg, device, channel, ch_out, attr, type);
+	tinyiiod_unlock(iiod);
+
+	return id;
+}
+
+int32_t tinyiiod_next_attr_name(struct tinyiiod *iiod, int32_t id,
+				const char *device, const char *channel,
+				bool ch_out, enum iio_attr_type type,
+				char *name, size_t len)
+{
+	struct tinyiiod_registry *reg;
+	struct tinyiiod_reg_attr *entry;
+	int32_t dev = -ENOMEM;
+
+	if (iiod->ops->context)
+		return desc_next_attr(iiod->ops->context, id, device, channel,
+				      ch_out, type, name, len);
+
+	tinyiiod_lock(iiod);
+	reg = registry_built(iiod);
+	if (reg)
+		dev = registry_find_device(reg, device);
+	if (dev >= 0)
+		id = registry_next_attr(reg, id, (uint32_t) dev, channel,
+					ch_out, type);
+	else
+		id = dev;
+
+	/* The names of the registry are not NUL-terminated */
+	if (id >= 0) {
+		entry = &reg->attrs[id];
+		if (entry->name_len < len) {
+			memcpy(name, entry->name, entry->name_len);
+			name[entry->name_len] = '\0';
+		} else {
+			name[0] = '\0';
+		}
+	}
+	tinyiiod_unlock(iiod);
+
+	return id;
+}
+
+ssize_t tinyiiod_desc_read_attr(struct tinyiiod *iiod, const char *device,
+				const char *channel, bool ch_out, const char *attr,
+				enum iio_attr_type type, char *buf, size_t len)
+{
+	const struct tinyiiod_device_desc *dev;
+	const struct tinyiiod_channel_desc *ch;
+	const struct tinyiiod_attr_desc *desc;
+	int32_t ret;
+
+	tinyiiod_lock(iiod);
+	ret = desc_find(iiod, device, channel, ch_out, attr, type,
+			&dev, &ch, &desc);
+	tinyiiod_unlock(iiod);
+	if (ret < 0)
+		return ret;
+
+	if (!desc->show)
+		return -ENOSYS;
+
+	return desc->show(dev, ch, desc, buf, len);
+}
+
+ssize_t tinyiiod_desc_write_attr(struct tinyiiod *iiod, const char *device,
+				 const char *channel, bool ch_out,
+				 const char *attr, enum iio_attr_type type,
+				 const char *buf, size_t len)
+{
+	const struct tinyiiod_device_desc *dev;
+	const struct tinyiiod_channel_desc *ch;
+	const struct tinyiiod_attr_desc *desc;
+	int32_t ret;
+
+	tinyiiod_lock(iiod);
+	ret = desc_find(iiod, device, channel, ch_out, attr, type,
+			&dev, &ch, &desc);
+	tinyiiod_unlock(iiod);
+	if (ret < 0)
+		return ret;
+
+	if (!desc->store)
+		return -ENOSYS;
+
+	return desc->store(dev, ch, desc, buf, len);
+}
+
+/* Slot holding the value of attr, of channel for descriptors, NULL when
+ * there is none */
+static struct tinyiiod_cache_entry * cache_slot(struct tinyiiod *root,
+		const void *attr, const struct tinyiiod_channel_desc *channel)
+{
+	unsigned int i;
+
+	for (i = 0; i < IIOD_CACHE_SIZE; i++)
+		if (root->cache[i].attr == attr &&
+		    root->cache[i].channel == channel)
+			return &root->cache[i];
+
+	return NULL;
+}
+
+static void cache_drop_slot(struct tinyiiod *root, const void *attr,
+			    const struct tinyiiod_channel_desc *channel)
+{
+	struct tinyiiod_cache_entry *slot = cache_slot(root, attr, channel);
+
+	if (slot)
+		slot->attr = NULL;
+}
+
+/* What the value of an attribute with a TTL belongs to */
+struct cache_key {
+	const void *attr;
+	const struct tinyiiod_channel_desc *channel;
+	uint32_t ttl_ms;
+};
+
+/* Key of an attribute with a TTL, false when it has none: its descriptor,
+ * or its registry entry, which is only used with the lock held */
+static bool cache_find(struct tinyiiod *iiod, const char *device,
+		       const char *channel, bool ch_out, const char *attr,
+		       enum iio_attr_type type, struct cache_key *key)
+{
+	struct tinyiiod_registry *reg = &iiod->root->registry;
+	const struct tinyiiod_device_desc *dev;
+	const struct tinyiiod_attr_desc *desc;
+	int32_t id;
+
+	if (iiod->ops->context) {
+		if (desc_find(iiod, device, channel, ch_out, attr, type,
+			      &dev, &key->channel, &desc) < 0)
+			return false;
+
+		key->attr = desc;
+		key->ttl_ms = desc->ttl_ms;
+		return !!key->ttl_ms;
+	}
+
+	/* TTLs are only set on an existing registry */
+	if (!reg->num_cached)
+		return false;
+
+	id = registry_lookup(reg, device, channel, ch_out, attr, type);
+	if (id < 0 || !reg->attrs[id].ttl_ms)
+		return false;
+
+	key->attr = &reg->attrs[id];
+	key->channel = NULL;
+	key->ttl_ms = reg->attrs[id].ttl_ms;
+	return true;
+}
+
+int32_t tinyiiod_set_attr_ttl(struct tinyiiod *iiod, const char *device,
+			      const char *channel, bool ch_out, const char *attr,
+			      enum iio_attr_type type, uint32_t ttl_ms)
+{
+	struct tinyiiod_registry *reg = &iiod->root->registry;
+	struct tinyiiod_reg_attr *entry;
+	int32_t id;
+
+	/* Descriptors have theirs in ttl_ms */
+	if (iiod->ops->context)
+		return -ENOSYS;
+
+	id = tinyiiod_get_registry(iiod);
+	if (id < 0)
+		return id;
+
+	tinyiiod_lock(iiod);
+	id = registry_lookup(reg, device, channel, ch_out, attr, type);
+	if (id >= 0) {
+		entry = &reg->attrs[id];
+		if (ttl_ms && !entry->ttl_ms)
+			reg->num_cached++;
+		else if (!ttl_ms && entry->ttl_ms)
+			reg->num_cached--;
+
+		entry->ttl_ms = ttl_ms;
+		cache_drop_slot(iiod->root, entry, NULL);
+	}
+	tinyiiod_unlock(iiod);
+
+	return id < 0 ? id : 0;
+}
+
+ssize_t tinyiiod_cache_get(struct tinyiiod *iiod, const char *device,
+			   const char *channel, bool ch_out, const char *attr,
+			   enum iio_attr_type type, uint32_t now,
+			   char *buf, size_t len)
+{
+	struct tinyiiod_cache_entry *slot = NULL;
+	struct cache_key key;
+	ssize_t ret = -ENOENT;
+
+	tinyiiod_lock(iiod);
+	if (cache_find(iiod, device, channel, ch_out, attr, type, &key))
+		slot = cache_slot(iiod->root, key.attr, key.channel);
+
+	if (slot && key.ttl_ms != TINYIIOD_TTL_STATIC &&
+	    (!iiod->ops->get_time_ms || now - slot->stamp >= key.ttl_ms)) {
+		slot->attr = NULL;
+	} else if (slot && slot->len > len) {
+		ret = -ENOSPC;
+	} else if (slot) {
+		memcpy(buf, slot->value, slot->len);
+		ret = (ssize_t) slot->len;
+	}
+	tinyiiod_unlock(iiod);
+
+	return ret;
+}
+
+void tinyiiod_cache_put(struct tinyiiod *iiod, const char *device,
+			const char *channel, bool ch_out, const char *attr,
+			enum iio_attr_type type, uint32_t now,
+			const char *buf, size_t len)
+{
+	struct tinyiiod *root = iiod->root;
+	struct tinyiiod_cache_entry *slot;
+	struct cache_key key;
+
+	if (len > IIOD_CACHE_VALUE_SIZE)
+		return;
+
+	tinyiiod_lock(iiod);
+
+	/* Without a clock, only static values can be kept */
+	if (cache_find(iiod, device, channel, ch_out, attr, type, &key) &&
+	    (key.ttl_ms == TINYIIOD_TTL_STATIC || iiod->ops->get_time_ms)) {
+		slot = cache_slot(root, key.attr, key.channel);
+		if (!slot) {
+			slot = &root->cache[root->cache_next];
+			root->cache_next = (root->cache_next + 1) %
+					   IIOD_CACHE_SIZE;
+		}
+
+		memcpy(slot->value, buf, len);
+		slot->attr = key.attr;
+		slot->channel = key.channel;
+		slot->len = len;
+		slot->stamp = now;
+	}
+	tinyiiod_unlock(iiod);
+}
+
+void tinyiiod_cache_drop(struct tinyiiod *iiod, const char *device,
+			 const char *channel, bool ch_out, const char *attr,
+			 enum iio_attr_type type)
+{
+	struct cache_key key;
+
+	tinyiiod_lock(iiod);
+	if (cache_find(iiod, device, channel, ch_out, attr, type, &key))
+		cache_drop_slot(iiod->root, key.attr, key.channel);
+	tinyiiod_unlock(iiod);
+}
+
+static const char xml_header[] =
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?><!DOCTYPE context [<!ELEMENT context "
+	"(device)*><!ELEMENT device (channel | attribute | debug-attribute | buffer-attribute)*><!ELEMENT "
+	"channel (scan-element?, attribute*)><!ELEMENT attribute EMPTY><!ELEMENT "
+	"scan-element EMPTY><!ELEMENT debug-attribute EMPTY><!ELEMENT buffer-attribute EMPTY><!ATTLIST context name "
+	"CDATA #REQUIRED description CDATA #IMPLIED><!ATTLIST device id CDATA "
+	"#REQUIRED name CDATA #IMPLIED><!ATTLIST channel id CDATA #REQUIRED type "
+	"(input|output) #REQUIRED name CDATA #IMPLIED><!ATTLIST scan-element index "
+	"CDATA #REQUIRED format CDATA #REQUIRED scale CDATA #IMPLIED><!ATTLIST "
+	"attribute name CDATA #REQUIRED filename CDATA #IMPLIED><!ATTLIST "
+	"debug-attribute name CDATA #REQUIRED><!ATTLIST buffer-attribute name "
+	"CDATA #REQUIRED value CDATA #IMPLIED>]>";
+
+/* Write str unless iiod is NULL, and return its length */
+static size_t xml_put(struct tinyiiod *iiod, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (iiod)
+		tinyiiod_write(iiod, str, len);
+
+	return len;
+}
+
+/* Same as xml_put(), with the characters markup is made of escaped */
+static size_t xml_put_escaped(struct tinyiiod *iiod, const char *str)
+{
+	const char *start = str, *entity;
+	size_t len = 0;
+
+	for (; *str; str++) {
+		switch (*str) {
+		case '"':
+			entity = "&quot;";
+			break;
+		case '&':
+			entity = "&amp;";
+			break;
+		case '<':
+			entity = "&lt;";
+			break;
+		case '>':
+			entity = "&gt;";
+			break;
+		default:
+			continue;
+		}
+
+		if (iiod)
+			tinyiiod_write(iiod, start, (size_t) (str - start));
+		len += (size_t) (str - start) + xml_put(iiod, entity);
+		start = str + 1;
+	}
+
+	if (iiod)
+		tinyiiod_write(iiod, start, (size_t) (str - start));
+
+	return len + (size_t) (str - start);
+}
+
+/* Write key="value", preceded by a space */
+static size_t xml_put_key(struct tinyiiod *iiod, const char *key,
+			  const char *value)
+{
+	size_t len;
+
+	len = xml_put(iiod, " ");
+	len += xml_put(iiod, key);
+	len += xml_put(iiod, "=\"");
+	len += xml_put_escaped(iiod, value);
+
+	return len + xml_put(iiod, "\"");
+}
+
+static size_t xml_put_attrs(struct tinyiiod *iiod,
+			    const struct tinyiiod_attr_desc *attrs,
+			    size_t num_attrs, bool channel)
+{
+	static const char * const tags[] = {
+		[IIO_ATTR_TYPE_DEVICE] = "<attribute",
+		[IIO_ATTR_TYPE_DEBUG] = "<debug-attribute",
+		[IIO_ATTR_TYPE_BUFFER] = "<buffer-attribute",
+	};
+	size_t i, len = 0;
+
+	for (i = 0; i < num_attrs; i++) {
+		len += xml_put(iiod, tags[channel ? IIO_ATTR_TYPE_DEVICE :
+					       attrs[i].type]);
+		len += xml_put_key(iiod, "name", attrs[i].name);
+		len += xml_put(iiod, " />");
+	}
+
+	return len;
+}
+
+static size_t xml_put_channel(struct tinyiiod *iiod,
+			      const struct tinyiiod_channel_desc *ch)
+{
+	const struct tinyiiod_scan_format *scan = ch->scan;
+	char format[64], index[12];
+	size_t len;
+
+	len = xml_put(iiod, "<channel");
+	len += xml_put_key(iiod, "id", ch->id);
+	if (ch->name)
+		len += xml_put_key(iiod, "name", ch->name);
+	len += xml_put_key(iiod, "type", ch->output ? "output" : "input");
+	len += xml_put(iiod, " >");
+
+	if (scan) {
+		size_t pos = 4;
+
+		tinyiiod_format_u64(index, ch->scan_index);
+
+		format[0] = scan->is_be ? 'b' : 'l';
+		format[1] = 'e';
+		format[2] = ':';
+		format[3] = scan->is_signed ? 's' : 'u';
+		pos += tinyiiod_format_u64(format + pos, scan->bits);
+		format[pos++] = '/';
+		pos += tinyiiod_format_u64(format + pos, scan->storage_bits);
+		if (scan->repeat > 1) {
+			format[pos++] = 'X';
+			pos += tinyiiod_format_u64(format + pos, scan->repeat);
+		}
+		format[pos++] = '>';
+		format[pos++] = '>';
+		tinyiiod_format_u64(format + pos, scan->shift);
+
+		len += xml_put(iiod, "<scan-element");
+		len += xml_put_key(iiod, "index", index);
+		len += xml_put_key(iiod, "format", format);
+		len += xml_put(iiod, " />");
+	}
+
+	len += xml_put_attrs(iiod, ch->attrs, ch->num_attrs, true);
+
+	return len + xml_put(iiod, "</channel>");
+}
+
+/* Write the context XML described by ctx, or only compute its length when
+ * iiod is NULL */
+size_t tinyiiod_desc_xml(struct tinyiiod *iiod,
+			 const struct tinyiiod_context_desc *ctx)
+{
+	const struct tinyiiod_device_desc *dev;
+	size_t i, j, len;
+
+	len = xml_put(iiod, xml_header);
+	len += xml_put(iiod, "<context");
+	len += xml_put_key(iiod, "name", ctx->name);
+	if (ctx->description)
+		len += xml_put_key(iiod, "description", ctx->description);
+	len += xml_put(iiod, " >");
+
+	for (i = 0; i < ctx->num_devices; i++) {
+		dev = &ctx->devices[i];
+
+		len += xml_put(iiod, "<device");
+		len += xml_put_key(iiod, "id", dev->id);
+		if (dev->name)
+			len += xml_put_key(iiod, "name", dev->name);
+		len += xml_put(iiod, " >");
+
+		for (j = 0; j < dev->num_channels; j++)
+			len += xml_put_channel(iiod, &dev->channels[j]);
+
+		len += xml_put_attrs(iiod, dev->attrs, dev->num_attrs, false);
+		len += xml_put(iiod, "</device>");
+	}
+
+	return len + xml_put(iiod, "</context>");
+}
@@ -0,0 +1,381 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2019 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Loopback benchmark of the protocol core: every command is replayed from
+ * memory through tinyiiod_read_command() and the responses are discarded,
+ * once checked to start with a status that is not an error and to all have
+ * the size of the first one. Usage: bench [scale], scale multiplying the
+ * number of iterations.
+ */
+
+#include "tinyiiod.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DATA_SIZE (1 << 20)
+
+/* Input stream: the command in input, replayed until remaining is 0 */
+static const char *input;
+static size_t input_len, input_pos, remaining;
+
+/* Output sink: responses are copied, as a transport would, then dropped;
+ * only the start of the output is kept, for its status */
+static char sink[0x10000];
+static char status[16];
+static size_t bytes_out;
+static const char *xml;
+static char data[DATA_SIZE];
+static unsigned int scale = 1;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static ssize_t loop_read_partial(char *buf, size_t len)
+{
+	size_t bytes = input_len - input_pos;
+
+	if (!remaining)
+		return 0;
+
+	if (bytes > len)
+		bytes = len;
+	if (bytes > remaining)
+		bytes = remaining;
+
+	memcpy(buf, input + input_pos, bytes);
+	input_pos = (input_pos + bytes) % input_len;
+	remaining -= bytes;
+
+	return (ssize_t) bytes;
+}
+
+static ssize_t loop_read(char *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = loop_read_partial(buf + done, len - done);
+		if (ret <= 0)
+			return ret;
+		done += (size_t) ret;
+	}
+
+	return (ssize_t) done;
+}
+
+static ssize_t loop_write(const char *buf, size_t len)
+{
+	size_t done, bytes;
+
+	for (done = 0; done < len; done += bytes) {
+		bytes = len - done < sizeof(sink) ? len - done : sizeof(sink);
+		memcpy(sink, buf + done, bytes);
+	}
+
+	if (bytes_out < sizeof(status) - 1) {
+		bytes = sizeof(status) - 1 - bytes_out;
+		memcpy(status + bytes_out, buf, len < bytes ? len : bytes);
+	}
+
+	bytes_out += len;
+
+	return (ssize_t) len;
+}
+
+static ssize_t read_attr(const char *device, const char *attr,
+			 char *buf, size_t len, enum iio_attr_type type)
+{
+	return (ssize_t) snprintf(buf, len, "1000");
+}
+
+static ssize_t write_attr(const char *device, const char *attr,
+			  const char *buf, size_t len, enum iio_attr_type type)
+{
+	return (ssize_t) len;
+}
+
+static ssize_t ch_read_attr(const char *device, const char *channel,
+			    bool ch_out, const char *attr, char *buf, size_t len)
+{
+	return (ssize_t) snprintf(buf, len, "0.033");
+}
+
+static ssize_t ch_write_attr(const char *device, const char *channel,
+			     bool ch_out, const char *attr, const char *buf,
+			     size_t len)
+{
+	return (ssize_t) len;
+}
+
+static int32_t open_dev(const char *device, size_t sample_size, uint32_t mask)
+{
+	return 0;
+}
+
+static int32_t close_dev(const char *device)
+{
+	return 0;
+}
+
+static int32_t get_mask(const char *device, uint32_t *mask)
+{
+	*mask = 0x3;
+
+	return 0;
+}
+
+static ssize_t read_data(const char *device, char *buf, size_t offset,
+			 size_t bytes_count)
+{
+	offset %= DATA_SIZE;
+	if (bytes_count > DATA_SIZE - offset)
+		bytes_count = DATA_SIZE - offset;
+
+	memcpy(buf, data + offset, bytes_count);
+
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t write_data(const char *device, const char *buf, size_t offset,
+			  size_t bytes_count)
+{
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t get_xml(char **outxml)
+{
+	*outxml = strdup(xml);
+
+	return *outxml ? 0 : -ENOMEM;
+}
+
+static struct tinyiiod_ops ops = {
+	.read = loop_read,
+	.write = loop_write,
+	.read_partial = loop_read_partial,
+
+	.read_attr = read_attr,
+	.write_attr = write_attr,
+	.ch_read_attr = ch_read_attr,
+	.ch_write_attr = ch_write_attr,
+
+	.open = open_dev,
+	.close = close_dev,
+	.get_mask = get_mask,
+	.read_data = read_data,
+	.write_data = write_data,
+
+	.get_xml = get_xml,
+};
+
+/* Run cmd, a command and its payload, iterations times; returns the time
+ * taken in seconds or a negative value on error */
+static double run(const char *cmd, size_t len, unsigned int iterations,
+		  const struct tinyiiod_config *config)
+{
+	struct tinyiiod *iiod = tinyiiod_create_ext(&ops, config);
+	unsigned int i;
+	double start, end;
+	size_t response;
+	int32_t ret;
+
+	if (!iiod)
+		return -1.0;
+
+	/* Warm up, and have PRINT cache the XML */
+	input = cmd;
+	input_len = len;
+	input_pos = 0;
+	remaining = len;
+	bytes_out = 0;
+	memset(status, 0, sizeof(status));
+	ret = tinyiiod_read_command(iiod);
+
+	/* An error is answered with a negative status instead */
+	response = bytes_out;
+	if (ret < 0 || !response || strtol(status, NULL, 10) < 0) {
+		tinyiiod_destroy(iiod);
+		return -1.0;
+	}
+
+	remaining = len * iterations;
+	bytes_out = 0;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		ret = tinyiiod_read_command(iiod);
+		if (ret < 0)
+			break;
+	}
+	end = now();
+
+	tinyiiod_destroy(iiod);
+
+	/* The same command must have been answered the same way */
+	if (i != iterations || bytes_out != response * iterations)
+		return -1.0;
+
+	return end - start;
+}
+
+static void bench_attr(const char *name, const char *cmd,
+		       unsigned int iterations)
+{
+	double t;
+
+	iterations *= scale;
+	t = run(cmd, strlen(cmd), iterations, NULL);
+	if (t < 0.0)
+		printf("%-32s failed\n", name);
+	else
+		printf("%-32s %12.0f cmd/s\n", name, iterations / t);
+}
+
+static void bench_readbuf(size_t buf_size, size_t bytes)
+{
+	struct tinyiiod_config config = { .buf_size = buf_size };
+	unsigned int iterations = (unsigned int) (256 * DATA_SIZE / bytes);
+	char cmd[64];
+	double t;
+
+	iterations = (iterations ? iterations : 1) * scale;
+	snprintf(cmd, sizeof(cmd), "READBUF bench %zu\r\n", bytes);
+
+	t = run(cmd, strlen(cmd), iterations, &config);
+	if (t < 0.0)
+		printf("READBUF buf %6zu bytes %8zu failed\n", buf_size, bytes);
+	else
+		printf("READBUF buf %6zu bytes %8zu    %10.1f MB/s\n", buf_size,
+		       bytes, (double) bytes * iterations / t / 1e6);
+}
+
+static void bench_writebuf(size_t buf_size, size_t bytes)
+{
+	struct tinyiiod_config config = { .buf_size = buf_size };
+	unsigned int iterations = (unsigned int) (256 * DATA_SIZE / bytes);
+	size_t len;
+	char *cmd;
+	double t;
+
+	cmd = malloc(bytes + 64);
+	if (!cmd)
+		return;
+
+	iterations = (iterations ? iterations : 1) * scale;
+	len = (size_t) sprintf(cmd, "WRITEBUF bench %zu\r\n", bytes);
+	memcpy(cmd + len, data, bytes);
+
+	t = run(cmd, len + bytes, iterations, &config);
+	if (t < 0.0)
+		printf("WRITEBUF buf %6zu bytes %8zu failed\n", buf_size, bytes);
+	else
+		printf("WRITEBUF buf %6zu bytes %8zu   %10.1f MB/s\n", buf_size,
+		       bytes, (double) bytes * iterations / t / 1e6);
+
+	free(cmd);
+}
+
+static char * make_xml(size_t size)
+{
+	static const char head[] = "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+		"<context name=\"bench\" ><device id=\"iio:device0\" name=\"bench\" >";
+	static const char tail[] = "</device></context>";
+	char *buf = malloc(size + 64), *ptr;
+	unsigned int i;
+
+	if (!buf)
+		return NULL;
+
+	ptr = buf + sprintf(buf, "%s", head);
+	for (i = 0; (size_t) (ptr - buf) + sizeof(tail) < size; i++)
+		ptr += sprintf(ptr, "<attribute name=\"attr%u\" />", i);
+	strcpy(ptr, tail);
+
+	return buf;
+}
+
+static void bench_print(size_t size)
+{
+	unsigned int iterations = (unsigned int) (64 * DATA_SIZE / size) * scale;
+	char *buf = make_xml(size);
+	double t;
+
+	if (!buf)
+		return;
+
+	xml = buf;
+	t = run("PRINT\r\n", sizeof("PRINT\r\n") - 1, iterations, NULL);
+	if (t < 0.0)
+		printf("PRINT xml %8zu failed\n", strlen(buf));
+	else
+		printf("PRINT xml %8zu                %10.2f us\n",
+		       strlen(buf), t / iterations * 1e6);
+
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t buf_sizes[] = { 256, 0x1000, 0x10000 };
+	static const size_t sizes[] = { 0x1000, 0x10000, 0x100000 };
+	unsigned int i, j;
+
+	if (argc > 1)
+		scale = (unsigned int) strtoul(argv[1], NULL, 10);
+	if (!scale)
+		scale = 1;
+
+	for (i = 0; i < DATA_SIZE; i++)
+		data[i] = (char) i;
+
+	xml = make_xml(0x1000);
+	if (!xml)
+		return EXIT_FAILURE;
+
+	bench_attr("READ device attribute",
+		   "READ bench sampling_frequency\r\n", 200000);
+	bench_attr("READ channel attribute",
+		   "READ bench INPUT voltage0 scale\r\n", 200000);
+	bench_attr("WRITE device attribute",
+		   "WRITE bench sampling_frequency 4\r\n1000", 200000);
+	bench_attr("WRITE channel attribute",
+		   "WRITE bench INPUT voltage0 scale 5\r\n0.033", 200000);
+	free((char *) xml);
+
+	for (i = 0; i < sizeof(buf_sizes) / sizeof(buf_sizes[0]); i++)
+		for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+			bench_readbuf(buf_sizes[i], sizes[j]);
+
+	for (i = 0; i < sizeof(buf_sizes) / sizeof(buf_sizes[0]); i++)
+		for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+			bench_writebuf(buf_sizes[i], sizes[j]);
+
+	for (i = 0x400; i <= 0x40000; i <<= 2)
+		bench_print(i);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,1375 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2019 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Loopback checks of the protocol core: commands are replayed from memory
+ * and the responses compared byte for byte with the expected ones. Every
+ * check starts from the default ops below, on an instance of its own.
+ */
+
+#include "tinyiiod.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DATA_SIZE 0x1000
+
+/* Input stream, consumed once */
+static const char *input;
+static size_t input_len, input_pos;
+
+/* Output stream, kept for the comparison */
+static char output[0x4000];
+static size_t output_len;
+static bool overflow;
+
+static unsigned int checks, failures;
+static struct tinyiiod *instance;
+
+/* Worker notifications, attribute reads, and ops called with the worker
+ * lock held */
+static unsigned int notified, reads, locked, locked_calls;
+
+/* Access of attribute "slow", completed by complete_slow() */
+static struct tinyiiod *pending;
+static char *pending_buf;
+
+/* Captured frames: every byte holds its offset */
+static char data[DATA_SIZE];
+static const size_t *frame_sizes;
+static unsigned int num_frame_sizes;
+static size_t get_data_max;
+
+static ssize_t loop_read(char *buf, size_t len)
+{
+	if (len > input_len - input_pos)
+		return 0;
+
+	memcpy(buf, input + input_pos, len);
+	input_pos += len;
+
+	return (ssize_t) len;
+}
+
+/* Hands out at most 5 bytes at a time */
+static ssize_t loop_read_partial(char *buf, size_t len)
+{
+	if (len > input_len - input_pos)
+		len = input_len - input_pos;
+	if (len > 5)
+		len = 5;
+
+	memcpy(buf, input + input_pos, len);
+	input_pos += len;
+
+	return (ssize_t) len;
+}
+
+static ssize_t loop_write(const char *buf, size_t len)
+{
+	if (len > sizeof(output) - output_len) {
+		overflow = true;
+		return -ENOSPC;
+	}
+
+	memcpy(output + output_len, buf, len);
+	output_len += len;
+
+	return (ssize_t) len;
+}
+
+/* Attribute "a" reads 1 and attribute "b" reads 22; "slow" completes
+ * later and "now" before its op returns, both asynchronously */
+static ssize_t read_attr(const char *device, const char *attr,
+			 char *buf, size_t len, enum iio_attr_type type)
+{
+	reads++;
+	if (locked)
+		locked_calls++;
+
+	if (!strcmp(attr, "a"))
+		return (ssize_t) snprintf(buf, len, "1");
+	if (!strcmp(attr, "b"))
+		return (ssize_t) snprintf(buf, len, "22");
+
+	if (!strcmp(attr, "slow")) {
+		pending = tinyiiod_caller(instance);
+		pending_buf = buf;
+		return -EINPROGRESS;
+	}
+
+	if (!strcmp(attr, "now")) {
+		tinyiiod_complete(tinyiiod_caller(instance),
+				  snprintf(buf, len, "444"));
+		return -EINPROGRESS;
+	}
+
+	return -ENOENT;
+}
+
+static unsigned int xml_calls;
+
+static ssize_t get_xml(char **outxml)
+{
+	xml_calls++;
+	*outxml = strdup("<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+			 "<context name=\"check\" ><device id=\"dev\" >"
+			 "<attribute name=\"a\" /><attribute name=\"b\" />"
+			 "</device></context>");
+
+	return *outxml ? 0 : -ENOMEM;
+}
+
+/* Clock of the TTLs and the time budgets, only moved by the checks and by
+ * tick_ms every time it is read */
+static uint32_t now_ms, tick_ms;
+
+static uint32_t get_time_ms(void)
+{
+	uint32_t now = now_ms;
+
+	if (locked)
+		locked_calls++;
+
+	now_ms += tick_ms;
+	return now;
+}
+
+/* Allocations made with the allocator */
+static unsigned int allocs;
+
+static void * check_alloc(void *priv, size_t size)
+{
+	if (locked)
+		locked_calls++;
+
+	allocs++;
+	return malloc(size);
+}
+
+static void check_free(void *priv, void *ptr)
+{
+	if (locked)
+		locked_calls++;
+
+	free(ptr);
+}
+
+static const struct tinyiiod_allocator allocator = {
+	.alloc = check_alloc,
+	.free = check_free,
+};
+
+static void notify_worker(void)
+{
+	notified++;
+}
+
+static void lock(void)
+{
+	locked++;
+}
+
+static void unlock(void)
+{
+	locked--;
+}
+
+/* Mask given to the last open */
+static uint32_t opened_mask;
+
+static int32_t open_dev(const char *device, size_t sample_size, uint32_t mask)
+{
+	opened_mask = mask;
+
+	return 0;
+}
+
+static int32_t close_dev(const char *device)
+{
+	return 0;
+}
+
+static int32_t get_mask(const char *device, uint32_t *mask)
+{
+	*mask = 0x7;
+
+	return 0;
+}
+
+static ssize_t transfer_dev_to_mem(const char *device, size_t bytes_count)
+{
+	return (ssize_t) bytes_count;
+}
+
+/* Pipelined capture, the wait for the block at offset 16 failing */
+static unsigned int started, waited;
+
+static ssize_t transfer_start(const char *device, size_t offset,
+			      size_t bytes_count)
+{
+	started++;
+
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t transfer_wait(const char *device, size_t offset,
+			     size_t bytes_count)
+{
+	waited++;
+
+	return offset == 16 ? -EIO : (ssize_t) bytes_count;
+}
+
+/* Pipelined playback, write_data failing at offset write_fail; what it
+ * got is kept in written */
+static unsigned int play_started, play_waited;
+static size_t write_fail;
+static char written[DATA_SIZE];
+
+static ssize_t play_start(const char *device, size_t offset,
+			  size_t bytes_count)
+{
+	play_started++;
+
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t play_wait(const char *device, size_t offset,
+			 size_t bytes_count)
+{
+	play_waited++;
+
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t write_data(const char *device, const char *buf, size_t offset,
+			  size_t bytes_count)
+{
+	if (offset + bytes_count > write_fail)
+		return -EIO;
+
+	memcpy(written + offset, buf, bytes_count);
+
+	return (ssize_t) bytes_count;
+}
+
+static ssize_t read_data(const char *device, char *buf, size_t offset,
+			 size_t bytes_count)
+{
+	if (offset >= DATA_SIZE)
+		return -EINVAL;
+	if (bytes_count > DATA_SIZE - offset)
+		bytes_count = DATA_SIZE - offset;
+
+	memcpy(buf, data + offset, bytes_count);
+
+	return (ssize_t) bytes_count;
+}
+
+/* Hands out at most get_data_max bytes at a time */
+static ssize_t get_data(const char *device, const char **buf, size_t offset,
+			size_t bytes_count)
+{
+	if (offset >= DATA_SIZE)
+		return -EINVAL;
+	if (bytes_count > get_data_max)
+		bytes_count = get_data_max;
+
+	*buf = data + offset;
+
+	return (ssize_t) bytes_count;
+}
+
+static int32_t get_frame_layout(const char *device,
+				struct tinyiiod_frame_layout *layout)
+{
+	layout->sizes = frame_sizes;
+	layout->num_channels = num_frame_sizes;
+
+	return 0;
+}
+
+static ssize_t session_read(void *priv, char *buf, size_t len)
+{
+	return loop_read(buf, len);
+}
+
+static ssize_t session_write(void *priv, const char *buf, size_t len)
+{
+	return loop_write(buf, len);
+}
+
+static const struct tinyiiod_session_ops session_ops = {
+	.read = session_read,
+	.write = session_write,
+};
+
+static const struct tinyiiod_ops default_ops = {
+	.read = loop_read,
+	.write = loop_write,
+
+	.read_attr = read_attr,
+
+	.open = open_dev,
+	.close = close_dev,
+	.get_mask = get_mask,
+	.transfer_dev_to_mem = transfer_dev_to_mem,
+	.read_data = read_data,
+	.write_data = write_data,
+
+	.get_xml = get_xml,
+};
+
+static struct tinyiiod_ops ops;
+
+static struct tinyiiod * setup_ext(const struct tinyiiod_config *config)
+{
+	instance = tinyiiod_create_ext(&ops, config);
+	pending = NULL;
+
+	output_len = 0;
+	overflow = false;
+
+	return instance;
+}
+
+static struct tinyiiod * setup(void)
+{
+	return setup_ext(NULL);
+}
+
+static void complete_slow(void)
+{
+	memcpy(pending_buf, "333", 3);
+	tinyiiod_complete(pending, 3);
+}
+
+/* Replay the commands of in, len bytes, through tinyiiod_read_command() */
+static void run(struct tinyiiod *iiod, const char *in, size_t len)
+{
+	size_t pos;
+
+	input = in;
+	input_len = len;
+	input_pos = 0;
+
+	while (input_pos < input_len) {
+		pos = input_pos;
+		tinyiiod_read_command(iiod);
+
+		/* Stop where a command was not read to its end */
+		if (input_pos == pos)
+			break;
+	}
+}
+
+/* Pass the commands of in, len bytes, to tinyiiod_feed() one byte at a
+ * time; returns the result of the last call */
+static int32_t feed(struct tinyiiod *iiod, const char *in, size_t len)
+{
+	int32_t ret = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		ret = tinyiiod_feed(iiod, in + i, 1);
+
+	return ret;
+}
+
+static void dump(const char *what, const char *buf, size_t len)
+{
+	size_t i;
+
+	printf("  %-8s ", what);
+	for (i = 0; i < len; i++) {
+		if (buf[i] >= ' ' && buf[i] <= '~' && buf[i] != '\\')
+			putchar(buf[i]);
+		else
+			printf("\\x%02x", (unsigned char) buf[i]);
+	}
+	putchar('\n');
+}
+
+/* Compare the output of the check name with the len bytes of expected */
+static void expect(const char *name, const char *expected, size_t len)
+{
+	checks++;
+
+	if (!overflow && output_len == len && !memcmp(output, expected, len))
+		return;
+
+	failures++;
+	printf("FAIL %s\n", name);
+	dump("expected", expected, len);
+	dump(overflow ? "got (cut)" : "got", output, output_len);
+}
+
+#define EXPECT(name, str) expect(name, str, sizeof(str) - 1)
+
+/* Replay the in_len bytes of in on an instance of its own, created with
+ * config or the defaults when NULL, then compare its output as expect() */
+static void expect_run(const char *name, const struct tinyiiod_config *config,
+		       const char *in, size_t in_len,
+		       const char *expected, size_t len)
+{
+	struct tinyiiod *iiod = setup_ext(config);
+
+	run(iiod, in, in_len);
+	expect(name, expected, len);
+	tinyiiod_destroy(iiod);
+}
+
+#define EXPECT_RUN(name, config, in, str) \
+	expect_run(name, config, in, sizeof(in) - 1, str, sizeof(str) - 1)
+
+/* Check that the output is a PRINT response, the XML length followed by
+ * the XML, holding part somewhere */
+static void expect_xml(const char *name, const char *part)
+{
+	size_t len = strlen(part), i;
+	char *end;
+	long xml_len;
+
+	checks++;
+
+	xml_len = overflow || !output_len ? -1 : strtol(output, &end, 10);
+	if (xml_len > 0 && *end == '\n' &&
+	    (size_t) xml_len == output_len - (size_t) (end + 1 - output) - 1) {
+		for (i = (size_t) (end + 1 - output); i + len <= output_len;
+		     i++)
+			if (!memcmp(output + i, part, len))
+				return;
+	}
+
+	failures++;
+	printf("FAIL %s\n", name);
+	dump("part", part, len);
+	dump(overflow ? "got (cut)" : "got", output, output_len);
+}
+
+static void expect_value(const char *name, int32_t value, int32_t expected)
+{
+	checks++;
+
+	if (value == expected)
+		return;
+
+	failures++;
+	printf("FAIL %s\n  expected %d\n  got      %d\n", name,
+	       (int) expected, (int) value);
+}
+
+static ssize_t show_value(const struct tinyiiod_device_desc *dev,
+			  const struct tinyiiod_channel_desc *channel,
+			  const struct tinyiiod_attr_desc *attr,
+			  char *buf, size_t len)
+{
+	(*(unsigned int *) attr->priv)++;
+
+	return (ssize_t) snprintf(buf, len, "7");
+}
+
+static unsigned int shown;
+
+static const struct tinyiiod_attr_desc desc_attrs[] = {
+	{
+		.name = "v",
+		.show = show_value,
+		.ttl_ms = TINYIIOD_TTL_STATIC,
+		.priv = &shown,
+	},
+};
+
+/* Name longer than the default command line */
+#define NAME_10 "0123456789"
+#define NAME_130 NAME_10 NAME_10 NAME_10 NAME_10 NAME_10 NAME_10 NAME_10 \
+	NAME_10 NAME_10 NAME_10 NAME_10 NAME_10 NAME_10
+
+static unsigned int shown_long;
+
+static const struct tinyiiod_attr_desc long_attrs[] = {
+	{
+		.name = NAME_130,
+	},
+	{
+		.name = "w",
+		.show = show_value,
+		.priv = &shown_long,
+	},
+};
+
+static const struct tinyiiod_device_desc desc_devices[] = {
+	{
+		.id = "dev",
+		.name = "<\"a&b\">",
+		.attrs = desc_attrs,
+		.num_attrs = 1,
+	},
+	{
+		.id = "long",
+		.attrs = long_attrs,
+		.num_attrs = 2,
+	},
+};
+
+static const struct tinyiiod_context_desc desc_context = {
+	.name = "check",
+	.devices = desc_devices,
+	.num_devices = 2,
+};
+
+static void check_get_data(void)
+{
+	/* Sent from where get_data points, as many chunks as it takes */
+	ops.read_data = NULL;
+	ops.get_data = get_data;
+	get_data_max = 8;
+	EXPECT_RUN("READBUF with get_data", NULL, "READBUF dev 12\r\n",
+		   "8\n00000007\n\x00\x01\x02\x03\x04\x05\x06\x07"
+		   "4\n\x08\x09\x0a\x0b");
+}
+
+static void check_read_partial(void)
+{
+	static const char in[] = "WRITEBUF dev 8\r\n01234567READ dev b\r\n";
+	struct tinyiiod *iiod;
+
+	/* The payload starts in the read-ahead of the command line and ends
+	 * in later reads; the next command is found right after it */
+	ops.read_partial = loop_read_partial;
+	iiod = setup();
+	input = in;
+	input_len = sizeof(in) - 1;
+	input_pos = 0;
+	expect_value("WRITEBUF read in part", tinyiiod_read_command(iiod), 0);
+	expect_value("READ read in part", tinyiiod_read_command(iiod), 0);
+	EXPECT("commands read in part", "8\n8\n2\n22\n");
+	expect_value("payload read in part", memcmp(written, "01234567", 8), 0);
+	tinyiiod_destroy(iiod);
+}
+
+static int32_t get_block_info(const char *device, size_t offset,
+			      size_t bytes_count,
+			      struct tinyiiod_block_info *info)
+{
+	info->timestamp = 0x1234abcd;
+	info->overflow = false;
+
+	return 0;
+}
+
+static void check_metadata(void)
+{
+	static const char in[] = "OPEN dev 4 7 METADATA\r\n"
+		"READBUF dev 8\r\nREADBUF dev 4\r\n";
+
+	/* Timestamp, position since OPEN and overflow flag */
+	ops.get_block_info = get_block_info;
+	EXPECT_RUN("READBUF metadata", NULL, in,
+		   "0\n8\n00000007\n000000001234abcd 0 0\n"
+		   "\x00\x01\x02\x03\x04\x05\x06\x07"
+		   "4\n00000007\n000000001234abcd 8 0\n\x00\x01\x02\x03");
+}
+
+/* Calls of the write ops */
+static unsigned int writes, writevs;
+
+static ssize_t count_write(const char *buf, size_t len)
+{
+	writes++;
+
+	return loop_write(buf, len);
+}
+
+static ssize_t count_writev(const struct tinyiiod_span *spans,
+			    unsigned int count)
+{
+	ssize_t ret, len = 0;
+	unsigned int i;
+
+	writevs++;
+	for (i = 0; i < count; i++) {
+		ret = loop_write(spans[i].buf, spans[i].len);
+		if (ret < 0)
+			return ret;
+		len += ret;
+	}
+
+	return len;
+}
+
+static void check_writev(void)
+{
+	static const char in[] = "READBUF dev 512\r\n";
+	static char plain[0x400];
+	size_t plain_len;
+	struct tinyiiod *iiod;
+
+	/* The chunk is larger than the coalescing buffer: its header goes
+	 * through it, the data are written on their own */
+	ops.write = count_write;
+	writes = 0;
+	iiod = setup();
+	run(iiod, in, sizeof(in) - 1);
+	expect_value("writes of a large chunk", (int32_t) writes, 2);
+	tinyiiod_destroy(iiod);
+	memcpy(plain, output, output_len);
+	plain_len = output_len;
+
+	/* The same bytes, in one writev of the header and the data */
+	ops.writev = count_writev;
+	writes = 0;
+	writevs = 0;
+	iiod = setup();
+	run(iiod, in, sizeof(in) - 1);
+	expect("large chunk written with writev", plain, plain_len);
+	expect_value("writes with writev", (int32_t) writes, 0);
+	expect_value("writevs of a large chunk", (int32_t) writevs, 1);
+
+	/* Small responses are still coalesced */
+	output_len = 0;
+	run(iiod, "READ dev a\r\n", sizeof("READ dev a\r\n") - 1);
+	EXPECT("small response with writev", "1\n1\n");
+	expect_value("writes of a small response", (int32_t) writes, 1);
+	expect_value("writevs of a small response", (int32_t) writevs, 1);
+	tinyiiod_destroy(iiod);
+}
+
+static char ring_buf[16];
+static struct tinyiiod_ring ring;
+
+static int32_t get_ring(const char *device, struct tinyiiod_ring **out)
+{
+	*out = &ring;
+
+	return 0;
+}
+
+/* Every step of a wait takes a second */
+static void yield_second(void)
+{
+	now_ms += 1000;
+}
+
+static void check_ring(void)
+{
+	struct tinyiiod *iiod;
+
+	memset(&ring, 0, sizeof(ring));
+	ring.buf = ring_buf;
+	ring.size = sizeof(ring_buf);
+	ops.get_ring = get_ring;
+	ops.get_time_ms = get_time_ms;
+	ops.yield = yield_second;
+	now_ms = 0;
+
+	iiod = setup();
+	run(iiod, "OPEN dev 4 1 METADATA\r\n",
+	    sizeof("OPEN dev 4 1 METADATA\r\n") - 1);
+
+	/* What does not fit is dropped and counted */
+	expect_value("push to the ring",
+		     (int32_t) tinyiiod_ring_push(&ring, data, 10), 10);
+	expect_value("push to a full ring",
+		     (int32_t) tinyiiod_ring_push(&ring, data, 10), 0);
+	expect_value("overflows of the ring", (int32_t) ring.overflows, 10);
+
+	/* The overflow is reported with the next block */
+	run(iiod, "READBUF dev 10\r\n", sizeof("READBUF dev 10\r\n") - 1);
+	EXPECT("READBUF of a ring after an overflow",
+	       "0\n10\n00000007\n0000000000000000 0 1\n"
+	       "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09");
+
+	/* Data wrapping around are sent in two chunks */
+	expect_value("push wrapping around",
+		     (int32_t) tinyiiod_ring_push(&ring, data + 16, 10), 10);
+	output_len = 0;
+	run(iiod, "READBUF dev 10\r\n", sizeof("READBUF dev 10\r\n") - 1);
+	EXPECT("READBUF of a ring wrapping around",
+	       "6\n00000007\n0000000000000000 10 0\n"
+	       "\x10\x11\x12\x13\x14\x15" "4\n\x16\x17\x18\x19");
+
+	/* Nothing is produced: the wait gives up after IIOD_WAIT_TIMEOUT */
+	output_len = 0;
+	run(iiod, "READBUF dev 4\r\n", sizeof("READBUF dev 4\r\n") - 1);
+	EXPECT("READBUF of an empty ring", "-110\n");
+	tinyiiod_destroy(iiod);
+}
+
+static void check_budget(void)
+{
+	static const struct tinyiiod_config config = { .buf_size = 8 };
+	static const char readbuf[] = "TIMEOUT 2\r\nREADBUF dev 32\r\n";
+	static const char writebuf[] = "TIMEOUT 2\r\nWRITEBUF dev 32\r\n"
+		"0123456789abcdef0123456789abcdef" "READ dev a\r\n";
+	struct tinyiiod *iiod;
+
+	/* The clock moves by 1 ms for every chunk, the budget takes two */
+	ops.get_time_ms = get_time_ms;
+	now_ms = 0;
+	tick_ms = 1;
+
+	/* Cut to the first chunk, an empty one ends the buffer */
+	EXPECT_RUN("READBUF past its budget", &config, readbuf,
+		   "0\n8\n00000007\n\x00\x01\x02\x03\x04\x05\x06\x07" "0\n");
+
+	/* The rest of the payload is dropped, the next command answered */
+	memset(written, 0, sizeof(written));
+	iiod = setup_ext(&config);
+	run(iiod, writebuf, sizeof(writebuf) - 1);
+	EXPECT("WRITEBUF past its budget", "0\n32\n8\n1\n1\n");
+	expect_value("bytes of WRITEBUF played",
+		     !memcmp(written, "01234567", 8) && !written[8], 1);
+	tinyiiod_destroy(iiod);
+}
+
+static void check_demux(void)
+{
+	static const size_t sizes[] = { 2, 2, 8 };
+	static const size_t padded_sizes[] = { 4, 2, 2, 8 };
+	static const size_t interior_sizes[] = { 4, 2, 2 };
+
+	frame_sizes = sizes;
+	num_frame_sizes = 3;
+	ops.get_frame_layout = get_frame_layout;
+
+	/* 16-byte frames, two 2-byte channels packed in 4 bytes */
+	EXPECT_RUN("demux of 2-byte channels", NULL,
+		   "OPEN dev 2 3\r\nREADBUF dev 8\r\n",
+		   "0\n8\n00000003\n\x00\x01\x02\x03\x10\x11\x12\x13");
+
+	/* Only the 8-byte channel, found at the end of the frame */
+	EXPECT_RUN("demux of an 8-byte channel", NULL,
+		   "OPEN dev 2 4\r\nREADBUF dev 16\r\n",
+		   "0\n16\n00000004\n"
+		   "\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+		   "\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f");
+
+	/* Not a whole number of packed frames */
+	EXPECT_RUN("demux of a partial frame", NULL,
+		   "OPEN dev 2 3\r\nREADBUF dev 6\r\n", "0\n-22\n");
+
+	/* 4-byte and 2-byte channels, packed in 8 bytes with 2 of padding */
+	frame_sizes = padded_sizes;
+	num_frame_sizes = 4;
+	EXPECT_RUN("demux of padded frames", NULL,
+		   "OPEN dev 2 3\r\nREADBUF dev 16\r\n",
+		   "0\n16\n00000003\n"
+		   "\x00\x01\x02\x03\x04\x05\x00\x00"
+		   "\x10\x11\x12\x13\x14\x15\x00\x00");
+
+	/* The same frame size with and without the 2-byte channel between
+	 * the enabled ones, whose bytes must not reach the client */
+	frame_sizes = interior_sizes;
+	num_frame_sizes = 3;
+	EXPECT_RUN("demux of a disabled channel in the frame", NULL,
+		   "OPEN dev 2 5\r\nREADBUF dev 16\r\n",
+		   "0\n16\n00000005\n"
+		   "\x00\x01\x02\x03\x06\x07\x00\x00"
+		   "\x08\x09\x0a\x0b\x0e\x0f\x00\x00");
+	frame_sizes = sizes;
+	num_frame_sizes = 3;
+
+	/* Frames handed out in pieces by get_data, without read_data: each
+	 * whole frame found is sent in a chunk of its own */
+	ops.read_data = NULL;
+	ops.get_data = get_data;
+	get_data_max = 24;
+	EXPECT_RUN("demux of get_data frames", NULL,
+		   "OPEN dev 2 3\r\nREADBUF dev 12\r\n",
+		   "0\n4\n00000003\n\x00\x01\x02\x03"
+		   "4\n\x10\x11\x12\x13" "4\n\x20\x21\x22\x23");
+
+	/* Less than a frame, and no read_data to fall back to */
+	get_data_max = 8;
+	EXPECT_RUN("demux of a partial get_data frame", NULL,
+		   "OPEN dev 2 3\r\nREADBUF dev 4\r\n", "0\n-5\n");
+}
+
+/* Header of client 0x0102: op, then a 32-bit value, the length of the
+ * arguments or the result */
+#define BINARY_HEADER(op, value) "\x02\x01" op "\x00" value
+
+static void check_pipelined(void)
+{
+	static const struct tinyiiod_config config = { .block_size = 16 };
+	struct tinyiiod *iiod;
+
+	ops.transfer_dev_to_mem_start = transfer_start;
+	ops.transfer_dev_to_mem_wait = transfer_wait;
+	started = 0;
+	waited = 0;
+
+	/* The blocks still in flight after the error are waited for */
+	iiod = setup_ext(&config);
+	run(iiod, "OPEN dev 2 7\r\nREADBUF dev 64\r\n",
+	    sizeof("OPEN dev 2 7\r\nREADBUF dev 64\r\n") - 1);
+	EXPECT("pipelined READBUF failing",
+	       "0\n16\n00000007\n"
+	       "\x00\x01\x02\x03\x04\x05\x06\x07"
+	       "\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f" "-5\n");
+	expect_value("blocks waited for", (int32_t) waited, (int32_t) started);
+	tinyiiod_destroy(iiod);
+}
+
+/* WRITEBUF of 64 bytes of data, sent in blocks of 16 */
+#define WRITEBUF_64 "WRITEBUF dev 64\r\n" \
+	"0123456789abcdef0123456789abcdef" \
+	"0123456789abcdef0123456789abcdef"
+
+static void check_writebuf_pipelined(void)
+{
+	static const struct tinyiiod_config config = { .block_size = 16 };
+	static const char in[] = WRITEBUF_64;
+	struct tinyiiod *iiod;
+
+	ops.transfer_mem_to_dev_start = play_start;
+	ops.transfer_mem_to_dev_wait = play_wait;
+	play_started = 0;
+	play_waited = 0;
+
+	/* The blocks still in flight after the error are waited for */
+	write_fail = 32;
+	iiod = setup_ext(&config);
+	run(iiod, in, sizeof(in) - 1);
+	EXPECT("pipelined WRITEBUF failing", "64\n-5\n");
+	expect_value("blocks played", (int32_t) play_started, 2);
+	expect_value("blocks waited for", (int32_t) play_waited,
+		     (int32_t) play_started);
+	tinyiiod_destroy(iiod);
+
+	/* Left playing on an opened device, until it is closed */
+	play_started = 0;
+	play_waited = 0;
+	iiod = setup_ext(&config);
+	run(iiod, "OPEN dev 4 1\r\n" WRITEBUF_64 "CLOSE dev\r\n",
+	    sizeof("OPEN dev 4 1\r\n" WRITEBUF_64 "CLOSE dev\r\n") - 1);
+	EXPECT("pipelined WRITEBUF failing on an opened device",
+	       "0\n64\n-5\n0\n");
+	expect_value("blocks of the opened device waited for",
+		     (int32_t) play_waited, (int32_t) play_started);
+	tinyiiod_destroy(iiod);
+}
+
+static void check_cyclic(void)
+{
+	static const char in[] = "OPEN dev 4 1 CYCLIC\r\n"
+		"WRITEBUF dev 4\r\n" "abcd" "WRITEBUF dev 4\r\n" "CLOSE dev\r\n";
+
+	/* Played by a backend without open_ext, the second push refused */
+	EXPECT_RUN("WRITEBUFs of a cyclic buffer", NULL, in,
+		   "0\n4\n4\n-16\n0\n");
+
+	/* Keywords the library does not know are ignored */
+	EXPECT_RUN("OPEN with an unknown keyword", NULL,
+		   "OPEN dev 4 1 OTHER\r\n", "0\n");
+}
+
+static void check_open_slots(void)
+{
+	static const char in[] = "OPEN d0 4 1\r\n" "OPEN d1 4 1\r\n"
+		"OPEN d2 4 1\r\n" "OPEN d3 4 1\r\n" "OPEN d4 4 1\r\n"
+		"OPEN " NAME_10 NAME_10 NAME_10 NAME_10 " 4 1\r\n"
+		"READBUF d4 4\r\n" "CLOSE d4\r\n";
+
+	/* Past the slots and their name size, devices are opened untracked */
+	EXPECT_RUN("OPENs of untracked devices", NULL, in,
+		   "0\n0\n0\n0\n0\n0\n4\n00000007\n\x00\x01\x02\x03" "0\n");
+}
+
+static void check_numbers(void)
+{
+	static const char in[] = "OPEN dev 4 1x\r\n"
+		"WRITE dev a 3x\r\n" "TIMEOUT 5s\r\n";
+	struct tinyiiod *iiod;
+
+	/* The mask can have the 0x prefix strtoul() took */
+	opened_mask = 0;
+	iiod = setup();
+	run(iiod, "OPEN dev 4 0x1\r\n", sizeof("OPEN dev 4 0x1\r\n") - 1);
+	EXPECT("OPEN with a 0x mask", "0\n");
+	expect_value("mask with a 0x prefix", (int32_t) opened_mask, 1);
+	tinyiiod_destroy(iiod);
+
+	/* Numbers followed by anything but the next argument */
+	EXPECT_RUN("numbers followed by garbage", NULL, in, "-22\n-22\n-22\n");
+}
+
+static int32_t echo_command(struct tinyiiod *iiod, char *args)
+{
+	tinyiiod_write_string(iiod, args);
+	tinyiiod_write_string(iiod, "\n");
+
+	return 0;
+}
+
+static int32_t fail_command(struct tinyiiod *iiod, char *args)
+{
+	return -EPERM;
+}
+
+static void check_commands(void)
+{
+	static const struct tinyiiod_command commands[] = {
+		{ "ECHO", echo_command },
+		{ "FAIL", fail_command },
+	};
+	static const char in[] = "ECHO a b\r\nFAIL\r\nECHOES\r\nVERSIONS\r\n";
+	struct tinyiiod *iiod;
+
+	/* Names only match in full, errors are sent back */
+	iiod = setup();
+	tinyiiod_register_commands(iiod, commands, 2);
+	run(iiod, in, sizeof(in) - 1);
+	EXPECT("registered commands", "a b\n-1\n-22\n-22\n");
+	tinyiiod_destroy(iiod);
+}
+
+static void check_xml_cache(void)
+{
+	static const char in[] = "PRINT\r\nPRINT\r\n";
+	struct tinyiiod *iiod;
+
+	/* Asked to the backend once, then again once invalidated */
+	xml_calls = 0;
+	iiod = setup();
+	run(iiod, in, sizeof(in) - 1);
+	expect_value("get_xml calls of cached PRINTs", (int32_t) xml_calls, 1);
+	tinyiiod_invalidate_xml(iiod);
+	output_len = 0;
+	run(iiod, "PRINT\r\n", sizeof("PRINT\r\n") - 1);
+	expect_value("get_xml calls once invalidated", (int32_t) xml_calls, 2);
+	expect_xml("PRINT once invalidated", "<device id=\"dev\" >");
+	tinyiiod_destroy(iiod);
+}
+
+/* Starts with the zstd magic number, the rest is not looked at */
+static const char zxml[] = "\x28\xb5\x2f\xfd\x00\x0a";
+
+static ssize_t get_zxml(const char **outzxml)
+{
+	*outzxml = zxml;
+
+	return sizeof(zxml) - 1;
+}
+
+static void check_zprint(void)
+{
+	/* Clients fall back to PRINT */
+	EXPECT_RUN("ZPRINT without get_zxml", NULL, "ZPRINT\r\n", "-38\n");
+
+	ops.get_zxml = get_zxml;
+	EXPECT_RUN("ZPRINT", NULL, "ZPRINT\r\n",
+		   "6\n\x28\xb5\x2f\xfd\x00\x0a\n");
+}
+
+/* Every command seems to take 10 cycles */
+static uint32_t cycles;
+
+static uint32_t get_cycles(void)
+{
+	cycles += 10;
+
+	return cycles;
+}
+
+static void check_stats(void)
+{
+	static const struct tinyiiod_config small = { .buf_size = 8 };
+	static const char in[] = "GETTRIG\r\nSTATS\r\n";
+
+	/* Name, count, bytes in and out, total and maximum cycles */
+	ops.get_cycles = get_cycles;
+	EXPECT_RUN("STATS", NULL, in, "-19\n20\nGETTRIG 1 9 4 10 10\n\n");
+
+	/* The lines do not fit in the buffer */
+	EXPECT_RUN("STATS longer than the buffer", &small, in, "-19\n-28\n");
+}
+
+static void check_binary(void)
+{
+	static const char in[] = "BINARY\r\n"
+		BINARY_HEADER("\x02", "\x05\x00\x00\x00") "dev a"
+		BINARY_HEADER("\x40", "\x00\x00\x00\x00");
+	static const char out[] = "0\n"
+		BINARY_HEADER("\x02", "\x01\x00\x00\x00") "1"
+		BINARY_HEADER("\x40", "\xea\xff\xff\xff");
+	static const char version_in[] = "BINARY\r\n"
+		BINARY_HEADER("\x00", "\x00\x00\x00\x00");
+	static const char version_out[] = "0\n"
+		BINARY_HEADER("\x00", "\x00\x00\x00\x00");
+	struct tinyiiod *iiod;
+	char version[64];
+	size_t len;
+
+	/* READ, then an unknown op */
+	iiod = setup();
+	run(iiod, in, sizeof(in) - 1);
+	expect("binary READ", out, sizeof(out) - 1);
+	tinyiiod_destroy(iiod);
+
+	/* The same, with headers and arguments split across feeds */
+	iiod = setup();
+	feed(iiod, in, sizeof(in) - 1);
+	expect("binary READ fed byte by byte", out, sizeof(out) - 1);
+	tinyiiod_destroy(iiod);
+
+	/* Strings carry their length instead of a trailing \n */
+	len = sizeof(version_out) - 1;
+	memcpy(version, version_out, len);
+	version[len - 4] = (char) snprintf(version + len, sizeof(version) - len,
+					   "%u.%u.%07llx",
+					   TINYIIOD_VERSION_MAJOR,
+					   TINYIIOD_VERSION_MINOR,
+					   (unsigned long long)
+					   TINYIIOD_VERSION_GIT);
+	len += (size_t) version[len - 4];
+	iiod = setup();
+	run(iiod, version_in, sizeof(version_in) - 1);
+	expect("binary VERSION", version, len);
+	tinyiiod_destroy(iiod);
+}
+
+/* Entries of "a" and "b" in a batched response */
+#define ENTRY_A "\x00\x00\x00\x02" "1\x00\x00\x00"
+#define ENTRY_B "\x00\x00\x00\x03" "22\x00\x00"
+
+static void check_batch_read(void)
+{
+	/* The names given, "c" failing with -ENOENT */
+	EXPECT_RUN("batched READ of names", NULL, "READ dev a b c\r\n",
+		   "20\n" ENTRY_A ENTRY_B "\xff\xff\xff\xfe" "\n");
+
+	/* All the attributes of the device, as listed in the XML */
+	EXPECT_RUN("batched READ of all attributes", NULL, "READ dev\r\n",
+		   "16\n" ENTRY_A ENTRY_B "\n");
+}
+
+/* Reads the ID of the attribute */
+static ssize_t read_attr_id(uint32_t id, char *buf, size_t len)
+{
+	return (ssize_t) snprintf(buf, len, "id%u", (unsigned int) id);
+}
+
+static void check_attr_ids(void)
+{
+	static const char in[] = "READ dev b\r\nREAD dev c\r\nREAD dev\r\n";
+	struct tinyiiod *iiod;
+
+	/* Numbered in the order of the XML */
+	ops.read_attr_id = read_attr_id;
+	iiod = setup();
+	expect_value("ID of an attribute",
+		     tinyiiod_attr_id(iiod, "dev", NULL, false, "b",
+				      IIO_ATTR_TYPE_DEVICE), 1);
+	expect_value("ID of a missing attribute",
+		     tinyiiod_attr_id(iiod, "dev", NULL, false, "c",
+				      IIO_ATTR_TYPE_DEVICE), -ENOENT);
+	expect_value("ID of a debug attribute",
+		     tinyiiod_attr_id(iiod, "dev", NULL, false, "b",
+				      IIO_ATTR_TYPE_DEBUG), -ENOENT);
+	run(iiod, in, sizeof(in) - 1);
+	EXPECT("READs by ID", "3\nid1\n-2\n16\n"
+	       "\x00\x00\x00\x04" "id0\x00" "\x00\x00\x00\x04" "id1\x00" "\n");
+	tinyiiod_destroy(iiod);
+}
+
+static void check_line_size(void)
+{
+	static const struct tinyiiod_config config = { .line_size = 16 };
+	static const char in[] = "READ dev a b c\r\nREAD dev a b cc\r\n";
+
+	/* 16 bytes with the \r\n are accepted, 17 are not */
+	EXPECT_RUN("lines of line_size bytes", &config, in,
+		   "20\n" ENTRY_A ENTRY_B "\xff\xff\xff\xfe" "\n");
+}
+
+static void check_async(void)
+{
+	static const char in[] = "READ dev slow\r\nREAD dev a\r\n";
+	static const char batch[] = "READ dev a slow b\r\n";
+	struct tinyiiod *iiod;
+
+	/* The next command waits for the access to be completed */
+	iiod = setup();
+	feed(iiod, in, sizeof(in) - 1);
+	expect_value("poll of a pending READ", tinyiiod_poll(iiod),
+		     -EINPROGRESS);
+	EXPECT("pending READ", "");
+	complete_slow();
+	expect_value("poll of a completed READ", tinyiiod_poll(iiod), 0);
+	EXPECT("completed READ", "3\n333\n1\n1\n");
+	tinyiiod_destroy(iiod);
+
+	/* Completed before the op returned, waited for by read_command */
+	EXPECT_RUN("READ completed in its op", NULL, "READ dev now\r\n",
+		   "3\n444\n");
+
+	/* The batch goes on with the attributes after the pending one */
+	iiod = setup();
+	feed(iiod, batch, sizeof(batch) - 1);
+	expect_value("poll of a pending batch", tinyiiod_poll(iiod),
+		     -EINPROGRESS);
+	complete_slow();
+	tinyiiod_poll(iiod);
+	EXPECT("completed batch", "24\n" ENTRY_A
+	       "\x00\x00\x00\x04" "333\x00" ENTRY_B "\n");
+	tinyiiod_destroy(iiod);
+}
+
+static void check_worker(void)
+{
+	static const char in[] = "READ dev a\r\nREAD dev b\r\n";
+	struct tinyiiod *iiod, *session;
+
+	ops.notify_worker = notify_worker;
+	ops.lock = lock;
+	ops.unlock = unlock;
+	notified = 0;
+	locked_calls = 0;
+
+	/* Answered once the worker ran the access, one command at a time */
+	iiod = setup();
+	feed(iiod, in, sizeof(in) - 1);
+	expect_value("poll before the worker ran", tinyiiod_poll(iiod),
+		     -EINPROGRESS);
+	EXPECT("READ queued for the worker", "");
+	expect_value("work of the first READ", tinyiiod_work(iiod), 1);
+	expect_value("poll after the first READ", tinyiiod_poll(iiod),
+		     -EINPROGRESS);
+	EXPECT("first READ run by the worker", "1\n1\n");
+	expect_value("work of the second READ", tinyiiod_work(iiod), 1);
+	expect_value("poll after the second READ", tinyiiod_poll(iiod), 0);
+	EXPECT("both READs run by the worker", "1\n1\n2\n22\n");
+	expect_value("work with an empty queue", tinyiiod_work(iiod), 0);
+	expect_value("worker notifications", (int32_t) notified, 2);
+	tinyiiod_destroy(iiod);
+
+	/* The access is completed asynchronously by the backend instead */
+	iiod = setup();
+	feed(iiod, "READ dev slow\r\n", sizeof("READ dev slow\r\n") - 1);
+	tinyiiod_work(iiod);
+	expect_value("poll of a pending access of the worker",
+		     tinyiiod_poll(iiod), -EINPROGRESS);
+	complete_slow();
+	tinyiiod_poll(iiod);
+	EXPECT("access of the worker completed later", "3\n333\n");
+	tinyiiod_destroy(iiod);
+
+	/* A session destroyed before the worker took its access */
+	iiod = setup();
+	session = tinyiiod_session_create(iiod, &session_ops, NULL, NULL);
+	feed(session, "READ dev a\r\n", sizeof("READ dev a\r\n") - 1);
+	tinyiiod_destroy(session);
+	reads = 0;
+	expect_value("work of a dropped access", tinyiiod_work(iiod), 1);
+	expect_value("reads of a dropped access", (int32_t) reads, 0);
+	EXPECT("dropped access", "");
+	tinyiiod_destroy(iiod);
+
+	expect_value("ops called with the lock held", (int32_t) locked_calls,
+		     0);
+	expect_value("lock released", (int32_t) locked, 0);
+}
+
+static void check_cache(void)
+{
+	static const struct tinyiiod_config heap = { .allocator = &allocator };
+	static const struct tinyiiod_config small = { .buf_size = 2 };
+	static const char in[] = "READ dev b\r\nREAD dev b\r\n";
+	struct tinyiiod *iiod, *session;
+
+	ops.get_time_ms = get_time_ms;
+	ops.lock = lock;
+	ops.unlock = unlock;
+	locked_calls = 0;
+	reads = 0;
+	now_ms = 0;
+
+	/* Read from the backend once, then again once the TTL has passed */
+	iiod = setup_ext(&heap);
+	expect_value("TTL of an attribute",
+		     tinyiiod_set_attr_ttl(iiod, "dev", NULL, false, "b",
+					   IIO_ATTR_TYPE_DEVICE, 10), 0);
+	run(iiod, in, sizeof(in) - 1);
+	EXPECT("READs of a cached attribute", "2\n22\n2\n22\n");
+	expect_value("reads of a cached attribute", (int32_t) reads, 1);
+	now_ms = 10;
+	run(iiod, in, sizeof(in) - 1);
+	expect_value("reads once the TTL passed", (int32_t) reads, 2);
+
+	/* The cached value does not fit in the buffer of the session */
+	session = tinyiiod_session_create(iiod, &session_ops, NULL, &small);
+	output_len = 0;
+	run(session, in, sizeof(in) - 1);
+	EXPECT("cached value longer than the buffer", "-28\n-28\n");
+	tinyiiod_destroy(session);
+	tinyiiod_destroy(iiod);
+
+	expect_value("clock and allocator called with the lock held",
+		     (int32_t) locked_calls, 0);
+}
+
+static void check_static_mem(void)
+{
+	static char mem[TINYIIOD_MEM_SIZE(256, 256, 256, 128)];
+	static char session_mem[TINYIIOD_MEM_SIZE(256, 256, 256, 128)];
+	struct tinyiiod_config session_config, config = {
+		.buf_size = 256,
+		.rx_size = 256,
+		.tx_size = 256,
+		.line_size = 128,
+		.mem = mem,
+	};
+	struct tinyiiod *iiod, *session;
+
+	config.mem_size = tinyiiod_mem_size(&config);
+	expect_value("size of the memory of an instance",
+		     config.mem_size <= sizeof(mem), 1);
+
+	/* The registry of the XML would come from the heap */
+	iiod = setup_ext(&config);
+	expect_value("instance in the memory given",
+		     (char *) iiod >= mem && (char *) iiod < mem + sizeof(mem),
+		     1);
+	run(iiod, "READ dev a\r\nREAD dev\r\n",
+	    sizeof("READ dev a\r\nREAD dev\r\n") - 1);
+	EXPECT("READs of an instance in static memory", "1\n1\n-12\n");
+
+	/* Sessions do not fall back to the heap either */
+	expect_value("session of an instance in static memory",
+		     tinyiiod_session_create(iiod, &session_ops, NULL,
+					     NULL) == NULL, 1);
+	session_config = config;
+	session_config.mem = session_mem;
+	session = tinyiiod_session_create(iiod, &session_ops, NULL,
+					  &session_config);
+	expect_value("session in the memory given",
+		     (char *) session >= session_mem &&
+		     (char *) session < session_mem + sizeof(session_mem), 1);
+	output_len = 0;
+	run(session, "READ dev a\r\n", sizeof("READ dev a\r\n") - 1);
+	EXPECT("READ of a session in static memory", "1\n1\n");
+	tinyiiod_destroy(session);
+	tinyiiod_destroy(iiod);
+
+	/* Descriptors are walked by name instead of looked up */
+	ops.context = &desc_context;
+	EXPECT_RUN("READs of descriptors in static memory", &config,
+		   "READ long w\r\nREAD dev w\r\nREAD none v\r\n",
+		   "1\n7\n-2\n-19\n");
+
+	config.mem_size /= 2;
+	expect_value("instance in too little memory",
+		     setup_ext(&config) == NULL, 1);
+}
+
+static void check_descriptors(void)
+{
+	static const struct tinyiiod_config heap = { .allocator = &allocator };
+	static const char lookups[] = "READ long w\r\nREAD <\"a&b\"> v\r\n"
+		"READ dev w\r\nREAD none v\r\n";
+	struct tinyiiod *iiod;
+	unsigned int created;
+
+	ops.context = &desc_context;
+	shown = 0;
+
+	/* Looked up in a registry allocated on the first access only */
+	iiod = setup_ext(&heap);
+	created = allocs;
+	run(iiod, "READ dev v\r\nREAD dev v\r\n",
+	    sizeof("READ dev v\r\nREAD dev v\r\n") - 1);
+	EXPECT("READ of a static descriptor attribute", "1\n7\n1\n7\n");
+	expect_value("show calls of a static attribute", (int32_t) shown, 1);
+	expect_value("registry of the descriptors built on access",
+		     allocs > created, 1);
+
+	output_len = 0;
+	run(iiod, lookups, sizeof(lookups) - 1);
+	EXPECT("READs looked up in the registry of the descriptors",
+	       "1\n7\n1\n7\n-2\n-19\n");
+
+	/* Walked in place, without a registry to give IDs */
+	output_len = 0;
+	run(iiod, "READ dev\r\n", sizeof("READ dev\r\n") - 1);
+	EXPECT("batched READ of descriptor attributes",
+	       "8\n\x00\x00\x00\x02" "7\x00\x00\x00" "\n");
+	/* Only the entry of the name too long fails */
+	output_len = 0;
+	run(iiod, "READ long\r\n", sizeof("READ long\r\n") - 1);
+	EXPECT("batched READ of a name too long",
+	       "12\n\xff\xff\xff\xdc" "\x00\x00\x00\x02" "7\x00\x00\x00"
+	       "\n");
+	expect_value("ID of a descriptor attribute",
+		     tinyiiod_attr_id(iiod, "dev", NULL, false, "v",
+				      IIO_ATTR_TYPE_DEVICE), -ENOSYS);
+
+	output_len = 0;
+	run(iiod, "PRINT\r\n", sizeof("PRINT\r\n") - 1);
+	expect_xml("XML of the descriptors", "<device id=\"dev\" "
+		   "name=\"&lt;&quot;a&amp;b&quot;&gt;\" >"
+		   "<attribute name=\"v\" /></device>");
+	tinyiiod_destroy(iiod);
+}
+
+int main(void)
+{
+	static void (* const all[])(void) = {
+		check_get_data,
+		check_read_partial,
+		check_metadata,
+		check_writev,
+		check_ring,
+		check_budget,
+		check_demux,
+		check_pipelined,
+		check_writebuf_pipelined,
+		check_cyclic,
+		check_open_slots,
+		check_numbers,
+		check_commands,
+		check_xml_cache,
+		check_zprint,
+		check_stats,
+		check_binary,
+		check_batch_read,
+		check_attr_ids,
+		check_line_size,
+		check_async,
+		check_worker,
+		check_cache,
+		check_static_mem,
+		check_descriptors,
+	};
+	unsigned int i;
+
+	for (i = 0; i < DATA_SIZE; i++)
+		data[i] = (char) i;
+
+	for (i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+		ops = default_ops;
+		write_fail = DATA_SIZE;
+		tick_ms = 0;
+		all[i]();
+	}
+
+	printf("%u checks, %u failures\n", checks, failures);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
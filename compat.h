@@ -37,6 +37,7 @@ typedef unsigned long int size_t;
 
 typedef long int32_t;
 typedef unsigned long uint32_t;
+typedef unsigned long long uint64_t;
 typedef int bool;
 
 #define true 1
@@ -46,13 +47,24 @@ typedef int bool;
 
 #define ENOENT		2	/* No such file or directory */
 #define EIO		5	/* I/O error */
+#define ENOMEM		12	/* Out of memory */
+#define EBUSY		16	/* Device or resource busy */
 #define ENODEV		19	/* No such device */
 #define EINVAL		22	/* Invalid argument */
+#define EFBIG		27	/* File too large */
+#define ENOSPC		28	/* No space left on device */
+#define ENAMETOOLONG	36	/* File name too long */
 #define ENOSYS		38	/* Function not implemented */
+#define ENOBUFS		105	/* No buffer space available */
+#define ETIMEDOUT	110	/* Connection timed out */
+#define EINPROGRESS	115	/* Operation now in progress */
 
 #define PRIi32		"li"
+# define PRIu32		"lu"
 # define PRIx32		"x"
 # define PRIu16		"u"
+# define PRIx64		"llx"
+# define PRIu64		"llu"
 #endif //_USE_STD_INT_TYPES
 
 #endif /* COMPAT_H */
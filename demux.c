@@ -0,0 +1,164 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2019 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+/* Samples are aligned to their own size within a frame, as in libiio */
+static size_t align_to(size_t offset, size_t size)
+{
+	return (offset + size - 1) / size * size;
+}
+
+int32_t tinyiiod_demux_init(struct tinyiiod_demux *demux,
+			    const struct tinyiiod_frame_layout *layout,
+			    uint32_t mask)
+{
+	struct tinyiiod_demux_span *span = NULL;
+	size_t src = 0, dst = 0, size, largest = 1, enabled = 1, data = 0;
+	unsigned int i;
+
+	if (layout->num_channels > IIOD_MAX_CHANNELS)
+		return -EINVAL;
+
+	demux->num_spans = 0;
+
+	for (i = 0; i < layout->num_channels; i++) {
+		size = layout->sizes[i];
+		if (!size)
+			return -EINVAL;
+
+		src = align_to(src, size);
+		if (size > largest)
+			largest = size;
+
+		if (mask & (1u << i)) {
+			dst = align_to(dst, size);
+			if (size > enabled)
+				enabled = size;
+
+			/* Channels contiguous in both frames are copied at once */
+			if (span && span->src + span->len == src &&
+			    span->dst + span->len == dst) {
+				span->len += size;
+			} else {
+				span = &demux->spans[demux->num_spans++];
+				span->src = src;
+				span->dst = dst;
+				span->len = size;
+			}
+			dst += size;
+			data += size;
+		}
+		src += size;
+	}
+
+	if (!dst)
+		return -EINVAL;
+
+	/* The packed frame is only padded for the channels it holds, as
+	 * libiio computes its sample size */
+	demux->hw_frame = align_to(src, largest);
+	demux->frame = align_to(dst, enabled);
+	demux->padded = data != demux->frame;
+
+	return 0;
+}
+
+bool tinyiiod_demux_needed(const struct tinyiiod_demux *demux)
+{
+	const struct tinyiiod_demux_span *span = &demux->spans[0];
+
+	/* A frame of the same size can still hold a disabled channel, whose
+	 * bytes have to be moved out or zeroed */
+	return demux->num_spans != 1 || span->src || span->dst ||
+		span->len != demux->hw_frame || demux->padded;
+}
+
+/* Zero the gaps a packed frame has around its channels, which would
+ * otherwise hold stale data */
+static void demux_pad(const struct tinyiiod_demux *demux, char *frame)
+{
+	const struct tinyiiod_demux_span *span;
+	size_t pos = 0;
+	unsigned int i;
+
+	for (i = 0; i < demux->num_spans; i++) {
+		span = &demux->spans[i];
+		memset(frame + pos, 0, span->dst - pos);
+		pos = span->dst + span->len;
+	}
+
+	memset(frame + pos, 0, demux->frame - pos);
+}
+
+/* Pack frames read from src into dst, which can be src itself */
+void tinyiiod_demux(const struct tinyiiod_demux *demux,
+		    char *dst, const char *src, size_t frames)
+{
+	const struct tinyiiod_demux_span *span;
+	unsigned int i;
+
+	/* The destination never overtakes the source, so memmove() suffices
+	 * in place; constant sizes let it compile to single word moves. A
+	 * frame is only padded once its source has been read */
+	if (demux->num_spans == 1 && !demux->padded) {
+		span = &demux->spans[0];
+
+		switch (span->len) {
+		case 2:
+			for (; frames; frames--, src += demux->hw_frame,
+			     dst += demux->frame)
+				memmove(dst, src + span->src, 2);
+			return;
+		case 4:
+			for (; frames; frames--, src += demux->hw_frame,
+			     dst += demux->frame)
+				memmove(dst, src + span->src, 4);
+			return;
+		case 8:
+			for (; frames; frames--, src += demux->hw_frame,
+			     dst += demux->frame)
+				memmove(dst, src + span->src, 8);
+			return;
+		default:
+			break;
+		}
+	}
+
+	for (; frames; frames--, src += demux->hw_frame, dst += demux->frame) {
+		for (i = 0; i < demux->num_spans; i++) {
+			span = &demux->spans[i];
+
+			switch (span->len) {
+			case 2:
+				memmove(dst + span->dst, src + span->src, 2);
+				break;
+			case 4:
+				memmove(dst + span->dst, src + span->src, 4);
+				break;
+			default:
+				memmove(dst + span->dst, src + span->src,
+					span->len);
+				break;
+			}
+		}
+
+		if (demux->padded)
+			demux_pad(demux, dst);
+	}
+}
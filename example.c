@@ -21,6 +21,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
 static ssize_t read_data(char *buf, size_t len)
 {
 	return fread(buf, 1, len, stdin);
@@ -31,103 +33,86 @@ static ssize_t write_data(const char *buf, size_t len)
 	return fwrite(buf, 1, len, stdout);
 }
 
-static ssize_t read_attr(const char *device, const char *attr,
-			 char *buf, size_t len, enum iio_attr_type type)
+static ssize_t show_string(const struct tinyiiod_device_desc *dev,
+			   const struct tinyiiod_channel_desc *channel,
+			   const struct tinyiiod_attr_desc *attr,
+			   char *buf, size_t len)
 {
-	if (!strcmp(device, "adc") || !strcmp(device, "0")) {
-		switch (type) {
-		case IIO_ATTR_TYPE_DEVICE:
-			return (ssize_t) snprintf(buf, len, "1000");
-		case IIO_ATTR_TYPE_DEBUG:
-			return (ssize_t) snprintf(buf, len, "0");
-		case IIO_ATTR_TYPE_BUFFER:
-			return (ssize_t) snprintf(buf, len, "8");
-		default:
-			return -ENOENT;
-		}
-	}
-
-	return -ENOENT;
+	return (ssize_t) snprintf(buf, len, "%s", (const char *) attr->priv);
 }
 
-static ssize_t write_attr(const char *device, const char *attr,
-			  const char *buf, size_t len, enum iio_attr_type type)
+static ssize_t show_raw(const struct tinyiiod_device_desc *dev,
+			const struct tinyiiod_channel_desc *channel,
+			const struct tinyiiod_attr_desc *attr,
+			char *buf, size_t len)
 {
-	return -ENOSYS;
+	return (ssize_t) snprintf(buf, len, "%s", (const char *) channel->priv);
 }
 
-static ssize_t ch_read_attr(const char *device, const char *channel,
-			    bool ch_out, const char *attr, char *buf, size_t len)
-{
-	if (!strcmp(device, "adc") || !strcmp(device, "0")) {
-		if (ch_out)
-			return -ENOENT;
-
-		if (!strcmp(channel, "voltage0")) {
-			if (!strcmp(attr, "scale"))
-				return (ssize_t) snprintf(buf, len, "0.033");
-			else if (!strcmp(attr, "raw"))
-				return (ssize_t) snprintf(buf, len, "256");
-		} else if (!strcmp(channel, "voltage1")) {
-			if (!strcmp(attr, "scale"))
-				return (ssize_t) snprintf(buf, len, "0.033");
-			else if (!strcmp(attr, "raw"))
-				return (ssize_t) snprintf(buf, len, "128");
-		}
-	}
-
-	return -ENOENT;
-}
+static const struct tinyiiod_attr_desc adc_channel_attrs[] = {
+	{ .name = "scale", .show = show_string, .priv = "0.033", },
+	{ .name = "raw", .show = show_raw, },
+};
 
-static ssize_t ch_write_attr(const char *device, const char *channel,
-			     bool ch_out, const char *attr, const char *buf, size_t len)
-{
-	return -ENOSYS;
-}
+static const struct tinyiiod_channel_desc adc_channels[] = {
+	{
+		.id = "voltage0",
+		.attrs = adc_channel_attrs,
+		.num_attrs = ARRAY_SIZE(adc_channel_attrs),
+		.priv = "256",
+	},
+	{
+		.id = "voltage1",
+		.attrs = adc_channel_attrs,
+		.num_attrs = ARRAY_SIZE(adc_channel_attrs),
+		.priv = "128",
+	},
+};
 
-static const char * const xml =
-	"<?xml version=\"1.0\" encoding=\"utf-8\"?><!DOCTYPE context [<!ELEMENT context "
-	"(device)*><!ELEMENT device (channel | attribute | debug-attribute | buffer-attribute)*><!ELEMENT "
-	"channel (scan-element?, attribute*)><!ELEMENT attribute EMPTY><!ELEMENT "
-	"scan-element EMPTY><!ELEMENT debug-attribute EMPTY><!ELEMENT buffer-attribute EMPTY><!ATTLIST context name "
-	"CDATA #REQUIRED description CDATA #IMPLIED><!ATTLIST device id CDATA "
-	"#REQUIRED name CDATA #IMPLIED><!ATTLIST channel id CDATA #REQUIRED type "
-	"(input|output) #REQUIRED name CDATA #IMPLIED><!ATTLIST scan-element index "
-	"CDATA #REQUIRED format CDATA #REQUIRED scale CDATA #IMPLIED><!ATTLIST "
-	"attribute name CDATA #REQUIRED filename CDATA #IMPLIED><!ATTLIST "
-	"debug-attribute name CDATA #REQUIRED><!ATTLIST buffer-attribute name "
-	"CDATA #REQUIRED value CDATA #IMPLIED>]><context name=\"tiny\" "
-	"description=\"Tiny IIOD\" >"
-	"<device id=\"0\" name=\"adc\" >"
-	"<channel id=\"voltage0\" type=\"input\" >"
-	"<attribute name=\"scale\" /><attribute name=\"raw\" /></channel>"
-	"<channel id=\"voltage1\" type=\"input\" >"
-	"<attribute name=\"scale\" /><attribute name=\"raw\" /></channel>"
-	"<attribute name=\"sample_rate\" />"
-	"<debug-attribute name=\"direct_reg_access\" />"
-	"<buffer-attribute name=\"length_align_bytes\" />"
-	"</device></context>";
-
-static ssize_t get_xml(char **outxml)
-{
+static const struct tinyiiod_attr_desc adc_attrs[] = {
+	{
+		.name = "sample_rate",
+		.type = IIO_ATTR_TYPE_DEVICE,
+		.show = show_string,
+		.priv = "1000",
+	},
+	{
+		.name = "direct_reg_access",
+		.type = IIO_ATTR_TYPE_DEBUG,
+		.show = show_string,
+		.priv = "0",
+	},
+	{
+		.name = "length_align_bytes",
+		.type = IIO_ATTR_TYPE_BUFFER,
+		.show = show_string,
+		.priv = "8",
+	},
+};
 
-	*outxml = calloc(1, strlen(xml) + 1);
-	if (!(*outxml))
-		return -ENOMEM;
-	memcpy(*outxml, xml, strlen(xml));
+static const struct tinyiiod_device_desc devices[] = {
+	{
+		.id = "0",
+		.name = "adc",
+		.channels = adc_channels,
+		.num_channels = ARRAY_SIZE(adc_channels),
+		.attrs = adc_attrs,
+		.num_attrs = ARRAY_SIZE(adc_attrs),
+	},
+};
 
-	return 0;
-}
+static const struct tinyiiod_context_desc context = {
+	.name = "tiny",
+	.description = "Tiny IIOD",
+	.devices = devices,
+	.num_devices = ARRAY_SIZE(devices),
+};
 
 static struct tinyiiod_ops ops = {
 	.read = read_data,
 	.write = write_data,
 
-	.read_attr = read_attr,
-	.write_attr = write_attr,
-	.ch_read_attr = ch_read_attr,
-	.ch_write_attr = ch_write_attr,
-	.get_xml = get_xml,
+	.context = &context,
 };
 
 static bool stop;
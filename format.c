@@ -0,0 +1,110 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2019 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+size_t tinyiiod_format_u64(char *buf, uint64_t value)
+{
+	char tmp[20];
+	size_t len = 0, i;
+	uint32_t low;
+
+	/* 64-bit divisions are expensive on 32-bit parts: only use them
+	 * for the digits above 32 bits */
+	while (value > 0xffffffff) {
+		tmp[len++] = (char) ('0' + value % 10);
+		value /= 10;
+	}
+
+	low = (uint32_t) value;
+	do {
+		tmp[len++] = (char) ('0' + low % 10);
+		low /= 10;
+	} while (low);
+
+	for (i = 0; i < len; i++)
+		buf[i] = tmp[len - 1 - i];
+	buf[len] = '\0';
+
+	return len;
+}
+
+size_t tinyiiod_format_i32(char *buf, int32_t value)
+{
+	if (value >= 0)
+		return tinyiiod_format_u64(buf, (uint32_t) value);
+
+	buf[0] = '-';
+	return 1 + tinyiiod_format_u64(buf + 1, 0u - (uint32_t) value);
+}
+
+size_t tinyiiod_format_hex(char *buf, uint64_t value, unsigned int digits)
+{
+	size_t len = 1, i;
+
+	while (len < 16 && (value >> (4 * len)))
+		len++;
+	if (len < digits)
+		len = digits;
+
+	for (i = 0; i < len; i++) {
+		size_t shift = 4 * (len - 1 - i);
+
+		buf[i] = shift < 64 ? hex_digits[(value >> shift) & 0xf] : '0';
+	}
+	buf[len] = '\0';
+
+	return len;
+}
+
+int32_t tinyiiod_parse_u32(const char *str, char **end,
+			   uint32_t base, uint32_t *value)
+{
+	const char *ptr;
+	uint32_t result = 0, digit;
+
+	for (ptr = str; ; ptr++) {
+		if (*ptr >= '0' && *ptr <= '9')
+			digit = (uint32_t) (*ptr - '0');
+		else if (*ptr >= 'a' && *ptr <= 'f')
+			digit = (uint32_t) (*ptr - 'a' + 10);
+		else if (*ptr >= 'A' && *ptr <= 'F')
+			digit = (uint32_t) (*ptr - 'A' + 10);
+		else
+			break;
+
+		if (digit >= base)
+			break;
+
+		/* Reject values that do not fit instead of wrapping */
+		if (result > (0xffffffff - digit) / base)
+			return -EINVAL;
+
+		result = result * base + digit;
+	}
+
+	if (end)
+		*end = (char *) ptr;
+	if (ptr == str)
+		return -EINVAL;
+
+	*value = result;
+	return 0;
+}
@@ -19,65 +19,93 @@
 
 #include "compat.h"
 
+/* Skip keyword when str starts with it, followed by a space or the end */
+static bool parse_keyword(char **str, const char *keyword)
+{
+	size_t len = strlen(keyword);
+
+	if (strncmp(*str, keyword, len) ||
+	    ((*str)[len] != ' ' && (*str)[len] != '\0'))
+		return false;
+
+	*str += len;
+	if (**str == ' ')
+		(*str)++;
+
+	return true;
+}
+
+/* Parse a number followed by the next argument or by the end of the line */
+static int32_t parse_number(char *str, char **end, uint32_t base,
+			    uint32_t *value)
+{
+	if (tinyiiod_parse_u32(str, end, base, value) ||
+	    (**end != ' ' && **end != '\0'))
+		return -EINVAL;
+
+	return 0;
+}
+
 static int32_t parse_rw_string(struct tinyiiod *iiod, char *str, bool write)
 {
 	char *device, *channel, *attr, *ptr;
 	bool is_channel = false, output = false;
 	enum iio_attr_type type = IIO_ATTR_TYPE_DEVICE;
-	long bytes;
+	uint32_t bytes;
 
-	ptr = strchr(str, ' ');
-	if (!ptr)
-		return -EINVAL;
-
-	*ptr = '\0';
 	device = str;
-	str = ptr + 1;
+	ptr = strchr(str, ' ');
+	if (ptr) {
+		*ptr = '\0';
+		str = ptr + 1;
+	} else {
+		str += strlen(str);
+	}
 
-	if (!strncmp(str, "INPUT ", sizeof("INPUT ") - 1)) {
+	if (parse_keyword(&str, "INPUT")) {
 		is_channel = true;
-		str += sizeof("INPUT ") - 1;
-	} else if (!strncmp(str, "OUTPUT ", sizeof("OUTPUT ") - 1)) {
+	} else if (parse_keyword(&str, "OUTPUT")) {
 		is_channel = true;
 		output = true;
-		str += sizeof("OUTPUT ") - 1;
-	} else if (!strncmp(str, "DEBUG ", sizeof("DEBUG ") - 1)) {
+	} else if (parse_keyword(&str, "DEBUG")) {
 		type = IIO_ATTR_TYPE_DEBUG;
-		str += sizeof("DEBUG ") - 1;
-	} else if (!strncmp(str, "BUFFER ", sizeof("BUFFER ") - 1)) {
+	} else if (parse_keyword(&str, "BUFFER")) {
 		type = IIO_ATTR_TYPE_BUFFER;
-		str += sizeof("BUFFER ") - 1;
 	}
 
 	if (is_channel) {
+		channel = str;
 		ptr = strchr(str, ' ');
-		if (!ptr)
+		if (ptr) {
+			*ptr = '\0';
+			str = ptr + 1;
+		} else {
+			str += strlen(str);
+		}
+
+		if (!*channel)
 			return -EINVAL;
-
-		*ptr = '\0';
-		channel = str;
-		str = ptr + 1;
 	} else {
 		channel = NULL;
 	}
 
+	if (!write) {
+		/* Without a name, all the attributes are read; several
+		 * names can be given separated with spaces */
+		tinyiiod_do_read_attr(iiod, device, channel, output,
+				      *str ? str : NULL, type);
+		return 0;
+	}
+
 	ptr = strchr(str, ' ');
-	if ((!!ptr) ^ write)
+	if (!ptr)
 		return -EINVAL;
 
 	attr = str;
+	*ptr = '\0';
+	str = ptr + 1;
 
-	if (write) {
-		*ptr = '\0';
-		str = ptr + 1;
-	} else {
-		tinyiiod_do_read_attr(iiod, device, channel,
-				      output, attr, type);
-		return 0;
-	}
-
-	bytes = strtol(str, &ptr, 10);
-	if (str == ptr || bytes < 0)
+	if (parse_number(str, &ptr, 10, &bytes))
 		return -EINVAL;
 
 	tinyiiod_do_write_attr(iiod, device, channel,
@@ -89,8 +117,7 @@ static int32_t parse_rw_string(struct tinyiiod *iiod, char *str, bool write)
 static int32_t parse_open_string(struct tinyiiod *iiod, char *str)
 {
 	char *device, *ptr;
-	long samples_count;
-	uint32_t mask = 0;
+	uint32_t samples_count, mask = 0, flags = 0;
 
 	ptr = strchr(str, ' ');
 	if (!ptr)
@@ -100,22 +127,45 @@ static int32_t parse_open_string(struct tinyiiod *iiod, char *str)
 	device = str;
 	str = ptr + 1;
 
-	samples_count = strtol(str, &ptr, 10);
-	if (str == ptr || *ptr != ' ' || samples_count < 0)
+	if (tinyiiod_parse_u32(str, &ptr, 10, &samples_count) || *ptr != ' ')
 		return -EINVAL;
 
 	str = ptr + 1;
 
-	mask = strtoul(str, NULL, 16);
+	/* As accepted by strtoul() */
+	if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+		str += 2;
 
-	tinyiiod_do_open(iiod, device, (size_t) samples_count, mask);
+	if (parse_number(str, &ptr, 16, &mask))
+		return -EINVAL;
+
+	while (*ptr == ' ') {
+		str = ptr + 1;
+		ptr = strchr(str, ' ');
+		if (!ptr)
+			ptr = str + strlen(str);
+
+		/* Other keywords are ignored, as they always were */
+		if ((size_t) (ptr - str) == sizeof("CYCLIC") - 1 &&
+		    !strncmp(str, "CYCLIC", sizeof("CYCLIC") - 1))
+			flags |= TINYIIOD_OPEN_CYCLIC;
+		else if ((size_t) (ptr - str) == sizeof("METADATA") - 1 &&
+			 !strncmp(str, "METADATA", sizeof("METADATA") - 1))
+			flags |= TINYIIOD_OPEN_METADATA;
+	}
+
+	tinyiiod_do_open(iiod, device, (size_t) samples_count, mask, flags);
 
 	return 0;
 }
 
 static int32_t parse_timeout_string(struct tinyiiod *iiod, char *str)
 {
-	uint32_t timeout = strtoul(str, NULL, 10);
+	uint32_t timeout;
+	char *ptr;
+
+	if (parse_number(str, &ptr, 10, &timeout))
+		return -EINVAL;
 
 	return tinyiiod_set_timeout(iiod, timeout);
 }
@@ -123,7 +173,7 @@ static int32_t parse_timeout_string(struct tinyiiod *iiod, char *str)
 static int32_t parse_writebuf_string(struct tinyiiod *iiod, char *str)
 {
 	char *device, *ptr;
-	long bytes_count;
+	uint32_t bytes_count;
 
 	ptr = strchr(str, ' ');
 	if (!ptr)
@@ -133,8 +183,7 @@ static int32_t parse_writebuf_string(struct tinyiiod *iiod, char *str)
 	device = str;
 	str = ptr + 1;
 
-	bytes_count = strtol(str, &ptr, 10);
-	if (str == ptr || *ptr != '\0' || bytes_count < 0)
+	if (tinyiiod_parse_u32(str, &ptr, 10, &bytes_count) || *ptr != '\0')
 		return -EINVAL;
 
 	return tinyiiod_do_writebuf(iiod, device, (size_t) bytes_count);
@@ -143,7 +192,7 @@ static int32_t parse_writebuf_string(struct tinyiiod *iiod, char *str)
 static int32_t parse_readbuf_string(struct tinyiiod *iiod, char *str)
 {
 	char *device, *ptr;
-	long bytes_count;
+	uint32_t bytes_count;
 
 	ptr = strchr(str, ' ');
 	if (!ptr)
@@ -153,65 +202,210 @@ static int32_t parse_readbuf_string(struct tinyiiod *iiod, char *str)
 	device = str;
 	str = ptr + 1;
 
-	bytes_count = strtol(str, &ptr, 10);
-	if (str == ptr || *ptr != '\0' || bytes_count < 0)
+	if (tinyiiod_parse_u32(str, &ptr, 10, &bytes_count) || *ptr != '\0')
 		return -EINVAL;
 
 	return tinyiiod_do_readbuf(iiod, device, (size_t) bytes_count);
 }
 
-int32_t tinyiiod_parse_string(struct tinyiiod *iiod, char *str)
+static int32_t parse_version_string(struct tinyiiod *iiod, char *str)
 {
-	while (*str == '\n' || *str == '\r')
-		str++;
+	char buf[32];
+	size_t len;
+
+	len = tinyiiod_format_u64(buf, TINYIIOD_VERSION_MAJOR);
+	buf[len++] = '.';
+	len += tinyiiod_format_u64(buf + len, TINYIIOD_VERSION_MINOR);
+	buf[len++] = '.';
+	len += tinyiiod_format_hex(buf + len, TINYIIOD_VERSION_GIT, 7);
+
+	/* Binary responses carry the length of the string, not its \n */
+	if (iiod->binary) {
+		tinyiiod_write_value(iiod, (int32_t) len);
+		tinyiiod_write(iiod, buf, len);
+	} else {
+		buf[len++] = '\n';
+		tinyiiod_write(iiod, buf, len);
+	}
 
-	if (str[0] == '\0')
-		return 0;
+	return 0;
+}
 
-	if (!strncmp(str, "VERSION", sizeof("VERSION"))) {
-		char buf[32];
+static int32_t parse_print_string(struct tinyiiod *iiod, char *str)
+{
+	tinyiiod_write_xml(iiod);
 
-		snprintf(buf, sizeof(buf), "%"PRIu16".%"PRIu16".%07x\n",
-			 TINYIIOD_VERSION_MAJOR,
-			 TINYIIOD_VERSION_MINOR,
-			 TINYIIOD_VERSION_GIT);
-		tinyiiod_write_string(iiod, buf);
-		return 0;
-	}
+	return 0;
+}
 
-	if (!strncmp(str, "PRINT", sizeof("PRINT"))) {
-		tinyiiod_write_xml(iiod);
-		return 0;
+static int32_t parse_zprint_string(struct tinyiiod *iiod, char *str)
+{
+	tinyiiod_write_zxml(iiod);
+
+	return 0;
+}
+
+static int32_t parse_read_string(struct tinyiiod *iiod, char *str)
+{
+	return parse_rw_string(iiod, str, false);
+}
+
+static int32_t parse_write_string(struct tinyiiod *iiod, char *str)
+{
+	return parse_rw_string(iiod, str, true);
+}
+
+static int32_t parse_close_string(struct tinyiiod *iiod, char *str)
+{
+	tinyiiod_do_close(iiod, str);
+
+	return 0;
+}
+
+static int32_t parse_exit_string(struct tinyiiod *iiod, char *str)
+{
+	/* The next client starts with the ASCII protocol */
+	iiod->binary = false;
+
+	return tinyiiod_do_close_instance(iiod);
+}
+
+static int32_t parse_gettrig_string(struct tinyiiod *iiod, char *str)
+{
+	return tinyiiod_write_value(iiod, -ENODEV);
+}
+
+static int32_t parse_stats_string(struct tinyiiod *iiod, char *str)
+{
+	return tinyiiod_do_stats(iiod);
+}
+
+static int32_t parse_binary_string(struct tinyiiod *iiod, char *str)
+{
+	/* Acknowledged in ASCII, everything after that is framed */
+	tinyiiod_write_value(iiod, 0);
+	iiod->binary = true;
+
+	return 0;
+}
+
+static const struct tinyiiod_command commands[IIOD_CMD_COUNT] = {
+	[IIOD_CMD_VERSION] = { "VERSION", parse_version_string },
+	[IIOD_CMD_PRINT] = { "PRINT", parse_print_string },
+	[IIOD_CMD_READ] = { "READ", parse_read_string },
+	[IIOD_CMD_WRITE] = { "WRITE", parse_write_string },
+	[IIOD_CMD_OPEN] = { "OPEN", parse_open_string },
+	[IIOD_CMD_CLOSE] = { "CLOSE", parse_close_string },
+	[IIOD_CMD_READBUF] = { "READBUF", parse_readbuf_string },
+	[IIOD_CMD_WRITEBUF] = { "WRITEBUF", parse_writebuf_string },
+	[IIOD_CMD_TIMEOUT] = { "TIMEOUT", parse_timeout_string },
+	[IIOD_CMD_EXIT] = { "EXIT", parse_exit_string },
+	[IIOD_CMD_GETTRIG] = { "GETTRIG", parse_gettrig_string },
+	[IIOD_CMD_BINARY] = { "BINARY", parse_binary_string },
+	[IIOD_CMD_ZPRINT] = { "ZPRINT", parse_zprint_string },
+	[IIOD_CMD_STATS] = { "STATS", parse_stats_string },
+};
+
+/* Pick the only candidate from the first character and the length of the
+ * command name; the caller still has to compare the full name */
+static int32_t find_command(const char *name, size_t len)
+{
+	switch (name[0]) {
+	case 'B':
+		return IIOD_CMD_BINARY;
+	case 'C':
+		return IIOD_CMD_CLOSE;
+	case 'E':
+		return IIOD_CMD_EXIT;
+	case 'G':
+		return IIOD_CMD_GETTRIG;
+	case 'O':
+		return IIOD_CMD_OPEN;
+	case 'P':
+		return IIOD_CMD_PRINT;
+	case 'R':
+		return len == sizeof("READ") - 1 ? IIOD_CMD_READ : IIOD_CMD_READBUF;
+	case 'S':
+		return IIOD_CMD_STATS;
+	case 'T':
+		return IIOD_CMD_TIMEOUT;
+	case 'V':
+		return IIOD_CMD_VERSION;
+	case 'W':
+		return len == sizeof("WRITE") - 1 ? IIOD_CMD_WRITE : IIOD_CMD_WRITEBUF;
+	case 'Z':
+		return IIOD_CMD_ZPRINT;
+	default:
+		return -ENOENT;
 	}
+}
 
-	if (!strncmp(str, "READ ", sizeof("READ ") - 1))
-		return parse_rw_string(iiod, str + sizeof("READ ") - 1, false);
+static bool match_command(const struct tinyiiod_command *cmd,
+			  const char *name, size_t len)
+{
+	return !strncmp(cmd->name, name, len) && cmd->name[len] == '\0';
+}
 
-	if (!strncmp(str, "WRITE ", sizeof("WRITE ") -1))
-		return parse_rw_string(iiod, str + sizeof("WRITE ") - 1, true);
+int32_t tinyiiod_parse_string(struct tinyiiod *iiod, char *str)
+{
+	const struct tinyiiod_command *cmd = NULL;
+	char *args;
+	size_t i, len;
+	int32_t id;
 
-	if (!strncmp(str, "OPEN ", sizeof("OPEN ") -1))
-		return parse_open_string(iiod, str + sizeof("OPEN ") - 1);
+	while (*str == '\n' || *str == '\r')
+		str++;
 
-	if (!strncmp(str, "CLOSE ", sizeof("CLOSE ") -1)) {
-		tinyiiod_do_close(iiod, str + sizeof("CLOSE ") - 1);
+	/* Blank lines, as left by clients ending payloads with \r\n, are not
+	 * commands */
+	if (str[0] == '\0') {
+		iiod->measuring = false;
 		return 0;
 	}
 
-	if (!strncmp(str, "READBUF ", sizeof("READBUF ") -1))
-		return parse_readbuf_string(iiod, str + sizeof("READBUF ") - 1);
+	args = strchr(str, ' ');
+	if (args) {
+		len = (size_t) (args - str);
+		args++;
+	} else {
+		len = strlen(str);
+		args = str + len;
+	}
+
+	id = find_command(str, len);
+	if (id >= 0 && match_command(&commands[id], str, len)) {
+		cmd = &commands[id];
+		iiod->cmd = (uint32_t) id;
+	} else {
+		for (i = 0; i < iiod->root->num_commands; i++) {
+			if (match_command(&iiod->root->commands[i], str, len)) {
+				cmd = &iiod->root->commands[i];
+				break;
+			}
+		}
+	}
+
+	if (!cmd)
+		return -EINVAL;
 
-	if (!strncmp(str, "TIMEOUT ", sizeof("TIMEOUT ") - 1))
-		return parse_timeout_string(iiod, str + sizeof("TIMEOUT ") - 1);
+	return cmd->handler(iiod, args);
+}
 
-	if (!strncmp(str, "WRITEBUF ", sizeof("WRITEBUF ") -1))
-		return parse_writebuf_string(iiod, str + sizeof("WRITEBUF ") - 1);
+const char * tinyiiod_command_name(uint32_t op)
+{
+	return op < IIOD_CMD_COUNT ? commands[op].name : "OTHER";
+}
 
-	if (!strncmp(str, "EXIT", sizeof("EXIT") - 1))
-		return tinyiiod_do_close_instance(iiod);
+int32_t tinyiiod_parse_binary(struct tinyiiod *iiod, uint32_t op, char *args)
+{
+	if (op < IIOD_CMD_COUNT) {
+		iiod->cmd = op;
+		return commands[op].handler(iiod, args);
+	}
 
-	if (!strncmp(str, "GETTRIG", sizeof("GETTRIG") - 1))
-		return tinyiiod_write_value(iiod, -ENODEV);
+	op -= IIOD_CMD_COUNT;
+	if (op < iiod->root->num_commands)
+		return iiod->root->commands[op].handler(iiod, args);
 
 	return -EINVAL;
 }
@@ -0,0 +1,129 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2019 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+/* Producer side: only head is written here, tail is only read */
+
+static size_t ring_free(const struct tinyiiod_ring *ring,
+			size_t head, size_t tail)
+{
+	return tail > head ? tail - head - 1 : ring->size - head + tail - 1;
+}
+
+char * tinyiiod_ring_reserve(struct tinyiiod_ring *ring, size_t *len)
+{
+	size_t head = ring->head, tail = ring->tail;
+	size_t bytes = ring_free(ring, head, tail);
+
+	/* Up to the end of the memory at most */
+	if (bytes > ring->size - head)
+		bytes = ring->size - head;
+
+	*len = bytes;
+	return ring->buf + head;
+}
+
+void tinyiiod_ring_commit(struct tinyiiod_ring *ring, size_t bytes)
+{
+	size_t head = ring->head + bytes;
+
+	if (head >= ring->size)
+		head -= ring->size;
+
+	/* The data must be visible before the new head */
+	TINYIIOD_RING_BARRIER();
+	ring->head = head;
+}
+
+size_t tinyiiod_ring_push(struct tinyiiod_ring *ring,
+			  const char *data, size_t len)
+{
+	size_t head = ring->head, tail = ring->tail, bytes;
+
+	if (len > ring_free(ring, head, tail)) {
+		ring->overflows += (uint32_t) len;
+		return 0;
+	}
+
+	bytes = ring->size - head;
+	if (bytes > len)
+		bytes = len;
+
+	memcpy(ring->buf + head, data, bytes);
+	memcpy(ring->buf, data + bytes, len - bytes);
+	tinyiiod_ring_commit(ring, len);
+
+	return len;
+}
+
+/* Consumer side, for READBUF: wait for at least min contiguous bytes at
+ * tail, at most until the budget of the transfer expires or for as long as
+ * any other wait */
+ssize_t tinyiiod_ring_wait(struct tinyiiod *iiod, struct tinyiiod_ring *ring,
+			   size_t min)
+{
+	struct tinyiiod_wait wait;
+	bool flushed = false;
+	size_t head, tail, bytes;
+
+	tinyiiod_wait_start(iiod, &wait);
+
+	for (;;) {
+		head = ring->head;
+		tail = ring->tail;
+
+		/* The data are read after the head telling they are there */
+		TINYIIOD_RING_BARRIER();
+
+		if (head >= tail) {
+			bytes = head - tail;
+		} else {
+			bytes = ring->size - tail;
+
+			/* A frame cannot wrap around */
+			if (bytes < min)
+				return -EINVAL;
+		}
+
+		if (bytes >= min)
+			return (ssize_t) bytes;
+
+		/* What was sent so far should not wait with the client */
+		if (!flushed) {
+			tinyiiod_flush(iiod);
+			flushed = true;
+		}
+
+		if (tinyiiod_budget_expired(iiod) ||
+		    !tinyiiod_wait_step(iiod, &wait))
+			return -ETIMEDOUT;
+	}
+}
+
+void tinyiiod_ring_release(struct tinyiiod_ring *ring, size_t bytes)
+{
+	size_t tail = ring->tail + bytes;
+
+	if (tail >= ring->size)
+		tail -= ring->size;
+
+	/* The data must have been read before the producer reuses them */
+	TINYIIOD_RING_BARRIER();
+	ring->tail = tail;
+}
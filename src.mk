@@ -1,4 +1,9 @@
 SRCS := $(ROOT)/parser.c			\
-	$(ROOT)/tinyiiod.c
+	$(ROOT)/tinyiiod.c			\
+	$(ROOT)/attr.c				\
+	$(ROOT)/demux.c				\
+	$(ROOT)/format.c				\
+	$(ROOT)/ring.c				\
+	$(ROOT)/worker.c
 
-UTESTS := example
+UTESTS := example bench check
@@ -20,26 +20,366 @@
 
 #include "tinyiiod.h"
 
-char tinyiiod_read_char(struct tinyiiod *iiod);
-ssize_t tinyiiod_read(struct tinyiiod *iiod, char *buf, size_t len);
-ssize_t tinyiiod_read_line(struct tinyiiod *iiod, char *buf, size_t len);
+#ifndef IIOD_RX_BUFFER_SIZE
+#define IIOD_RX_BUFFER_SIZE 256
+#endif
+
+/* Set to 0 to write responses without coalescing */
+#ifndef IIOD_TX_BUFFER_SIZE
+#define IIOD_TX_BUFFER_SIZE 256
+#endif
+
+/* Spans given to the writev op at once */
+#ifndef IIOD_MAX_SPANS
+#define IIOD_MAX_SPANS 4
+#endif
+
+/* Blocks of a pipelined transfer in flight at the same time */
+#ifndef IIOD_PIPELINE_DEPTH
+#define IIOD_PIPELINE_DEPTH 2
+#endif
+
+/* Attribute accesses waiting for tinyiiod_work(), one per session at most */
+#ifndef IIOD_JOB_QUEUE_SIZE
+#define IIOD_JOB_QUEUE_SIZE 8
+#endif
+
+/* Bound of the waits for the worker, the backend or a capture ring: in
+ * milliseconds when the client gave no timeout, in steps without a clock */
+#ifndef IIOD_WAIT_TIMEOUT
+#define IIOD_WAIT_TIMEOUT 5000
+#endif
+
+#ifndef IIOD_WAIT_STEPS
+#define IIOD_WAIT_STEPS 0x1000000
+#endif
+
+#ifndef IIOD_LINE_SIZE
+#define IIOD_LINE_SIZE 128
+#endif
+
+#ifndef IIOD_MAX_OPEN_DEVICES
+#define IIOD_MAX_OPEN_DEVICES 4
+#endif
+
+#ifndef IIOD_DEVICE_NAME_SIZE
+#define IIOD_DEVICE_NAME_SIZE 32
+#endif
+
+/* Attribute values with a TTL kept at the same time, and their longest
+ * value; longer values are read from the backend every time */
+#ifndef IIOD_CACHE_SIZE
+#define IIOD_CACHE_SIZE 8
+#endif
+
+#ifndef IIOD_CACHE_VALUE_SIZE
+#define IIOD_CACHE_VALUE_SIZE 32
+#endif
+
+/* Open flags the library handles itself for backends without open_ext: a
+ * cyclic buffer only accepts one WRITEBUF, the metadata are sent by READBUF */
+#define IIOD_OPEN_EMULATED (TINYIIOD_OPEN_CYCLIC | TINYIIOD_OPEN_METADATA)
+
+struct tinyiiod_open_dev {
+	/* Session that opened the device, NULL for a free slot */
+	struct tinyiiod *owner;
+	char name[IIOD_DEVICE_NAME_SIZE];
+	uint32_t flags;
+	uint32_t mask;
+	/* Bytes sent by READBUF since the device was opened */
+	uint64_t position;
+	/* A cyclic buffer only accepts one WRITEBUF */
+	bool pushed;
+	/* Buffer of samples_count frames, transferred in blocks of
+	 * block_size bytes when pipelined */
+	size_t samples_count;
+	size_t block_size;
+	/* Pipelined playback left running by the last WRITEBUF: the blocks
+	 * between waited and queued are still to be waited for */
+	size_t waited, queued;
+	/* Ring of a continuous capture, and its overflows at the last READBUF */
+	struct tinyiiod_ring *ring;
+	uint32_t overflows;
+};
+
+/* Channels of a device a frame layout can describe, one per mask bit */
+#define IIOD_MAX_CHANNELS 32
+
+/* Bytes copied from a full frame to a packed one */
+struct tinyiiod_demux_span {
+	size_t src, dst, len;
+};
+
+struct tinyiiod_demux {
+	struct tinyiiod_demux_span spans[IIOD_MAX_CHANNELS];
+	unsigned int num_spans;
+	/* Size of a full frame and of a packed one */
+	size_t hw_frame, frame;
+	/* The packed frame has gaps between its channels or at its end */
+	bool padded;
+};
+
+/*
+ * With TINYIIOD_OPEN_METADATA, the first chunk of every READBUF block carries
+ * the metadata of the block between the channel mask and the data. In ASCII
+ * mode it is a line holding the timestamp in hexadecimal, the position of
+ * the block in the bytes sent since OPEN and the overflow flag:
+ *	"%016" PRIx64 " %" PRIu64 " %u\n"
+ * In binary mode it is 20 bytes: timestamp and position as little-endian
+ * 64-bit words, then a 32-bit flags word whose bit 0 is the overflow flag.
+ */
+#define IIOD_BLOCK_META_SIZE 20
+
+/*
+ * Binary mode frames every request with a little-endian header:
+ *	bytes 0-1: client ID, echoed back in the response
+ *	byte 2: opcode, the index of the command in enum tinyiiod_cmd, or
+ *		IIOD_CMD_COUNT + n for the n-th registered command
+ *	byte 3: reserved, 0
+ *	bytes 4-7: length of the arguments string that follows
+ * Responses use the same header, bytes 4-7 then hold the signed return
+ * code in place of the textual integers of the ASCII protocol. Payloads
+ * are sent without their trailing newline, the channel mask of READBUF
+ * is sent as a little-endian 32-bit word.
+ */
+#define IIOD_BINARY_HEADER_SIZE 8
+
+enum tinyiiod_state {
+	IIOD_STATE_LINE,
+	IIOD_STATE_BINARY_HEADER,
+	IIOD_STATE_BINARY_ARGS,
+	IIOD_STATE_RUN,
+	IIOD_STATE_WRITE_ATTR,
+	IIOD_STATE_WRITEBUF,
+	/* Waiting for the worker, see tinyiiod_call() */
+	IIOD_STATE_PENDING,
+};
+
+/* Payload expected after the command line */
+struct tinyiiod_xfer {
+	const char *device, *channel, *attr;
+	/* Open state of the device of WRITEBUF, if opened */
+	struct tinyiiod_open_dev *dev;
+	bool ch_out;
+	enum iio_attr_type type;
+	size_t bytes;
+	/* End of the last pipelined block known to be played */
+	size_t waited;
+	/* Bytes of WRITEBUF handed to the device, what is kept past the
+	 * budget */
+	size_t accepted;
+	int32_t err;
+	/* Progress of a batched READ: end of the response in iiod->buf,
+	 * names left or ID of the last attribute read, and whether its op
+	 * returned -EINPROGRESS */
+	bool batch;
+	size_t pos;
+	char *next;
+	int32_t id;
+	bool deferred;
+};
+
+/* Progress of a wait, see tinyiiod_wait_step() */
+struct tinyiiod_wait {
+	uint32_t start;
+	uint32_t steps;
+};
+
+/* Backend call of a session left to the worker, or which returned
+ * -EINPROGRESS: run is called, by tinyiiod_work() with a worker, then done
+ * with its result by the thread servicing the session */
+struct tinyiiod_job {
+	ssize_t (*run)(struct tinyiiod *iiod);
+	void (*done)(struct tinyiiod *iiod, ssize_t ret);
+	ssize_t ret;
+	/* Not queued yet while the queue is full; also set while the backend
+	 * has to call tinyiiod_complete() */
+	bool queued;
+	volatile bool complete;
+	/* Taken from the queue by tinyiiod_work(), until it is done with
+	 * the session; only changed with the lock held */
+	bool running;
+};
+
+struct tinyiiod_reg_device {
+	const char *id, *name;
+	size_t id_len, name_len;
+};
+
+/* Attribute described in the context XML, its index is its ID */
+struct tinyiiod_reg_attr {
+	uint32_t device;
+	const char *channel, *name;
+	size_t channel_len, name_len;
+	bool ch_out;
+	enum iio_attr_type type;
+	uint32_t ttl_ms;
+};
+
+/* Attribute of a context descriptor, pointing into the descriptors */
+struct tinyiiod_desc_ref {
+	const struct tinyiiod_device_desc *dev;
+	const struct tinyiiod_channel_desc *channel;
+	const struct tinyiiod_attr_desc *attr;
+};
+
+/* Names found in the context XML, pointing into the cached XML, or the
+ * attributes of context, whose descriptors are never copied */
+struct tinyiiod_registry {
+	const struct tinyiiod_context_desc *context;
+	struct tinyiiod_reg_device *devices;
+	struct tinyiiod_reg_attr *attrs;
+	struct tinyiiod_desc_ref *refs;
+	size_t num_devices, num_attrs;
+	/* Attributes with a TTL */
+	size_t num_cached;
+	/* Open addressing hash tables of attribute index + 1 and of device
+	 * index + 1, found by ID and by name, 0 when free */
+	uint32_t *table;
+	size_t table_size;
+	uint32_t *dev_table;
+	size_t dev_table_size;
+};
+
+/* Value read from an attribute, the registry entry attr or the descriptor
+ * attr of channel; a free slot has no attr */
+struct tinyiiod_cache_entry {
+	const void *attr;
+	const struct tinyiiod_channel_desc *channel;
+	uint32_t stamp;
+	size_t len;
+	char value[IIOD_CACHE_VALUE_SIZE];
+};
+
+enum tinyiiod_cmd {
+	IIOD_CMD_VERSION,
+	IIOD_CMD_PRINT,
+	IIOD_CMD_READ,
+	IIOD_CMD_WRITE,
+	IIOD_CMD_OPEN,
+	IIOD_CMD_CLOSE,
+	IIOD_CMD_READBUF,
+	IIOD_CMD_WRITEBUF,
+	IIOD_CMD_TIMEOUT,
+	IIOD_CMD_EXIT,
+	IIOD_CMD_GETTRIG,
+	IIOD_CMD_BINARY,
+	IIOD_CMD_ZPRINT,
+	IIOD_CMD_STATS,
+	IIOD_CMD_COUNT,
+};
+
+/* Statistics of every command, plus registered and unknown commands */
+#define IIOD_STATS_COUNT (IIOD_CMD_COUNT + 1)
+
+struct tinyiiod {
+	struct tinyiiod_ops *ops;
+
+	/* Instance holding the state shared by all its sessions, the
+	 * instance itself when it was not created as a session */
+	struct tinyiiod *root;
+	const struct tinyiiod_session_ops *session_ops;
+	void *priv;
+
+	char *line;
+	size_t line_size;
+
+	/* Statistics, and the accounting of the command running as
+	 * stats[cmd] */
+	struct tinyiiod_cmd_stats stats[IIOD_STATS_COUNT];
+	uint32_t cmd;
+	bool measuring;
+	uint32_t cmd_start;
+	size_t cmd_in, cmd_out;
+
+	/* NULL for malloc() and free() */
+	const struct tinyiiod_allocator *allocator;
+	/* Instance and buffers carved from the memory given in the config */
+	bool static_mem;
+	uint32_t timeout;
+	/* Budget of the transfer running: the timeout from its start, when
+	 * there is a clock; expired is also set by a read timing out */
+	bool budgeted, expired;
+	uint32_t budget_start;
+
+	/* Progress through the command being received */
+	enum tinyiiod_state state;
+	size_t count;
+	bool found;
+	struct tinyiiod_xfer xfer;
+	struct tinyiiod_job job;
+	bool done;
+	int32_t ret;
+
+	char *buf;
+	size_t buf_size;
+	bool own_buf;
+	size_t block_size;
+
+	/* Read-ahead buffer, used when ops->read_partial is set and to keep
+	 * what tinyiiod_feed() receives while a command is pending */
+	char *rx_buf;
+	size_t rx_size, rx_start, rx_end;
+
+	/* Responses are gathered here until flushed */
+	char *tx_buf;
+	size_t tx_size, tx_len;
+
+	/* Sessions waiting for tinyiiod_work(): only the servicing thread
+	 * moves job_head and only the worker moves job_tail */
+	struct tinyiiod * volatile jobs[IIOD_JOB_QUEUE_SIZE];
+	volatile size_t job_head, job_tail;
+	/* Session an attribute op is being called for, see tinyiiod_caller() */
+	struct tinyiiod *caller;
+
+	/* Devices opened through the root instance and its sessions */
+	struct tinyiiod_open_dev open_devs[IIOD_MAX_OPEN_DEVICES];
+
+	/* Commands registered by the application */
+	const struct tinyiiod_command *commands;
+	size_t num_commands;
+
+	/* Context XML returned by ops->get_xml */
+	char *xml;
+	size_t xml_len;
+
+	struct tinyiiod_registry registry;
+	/* Values of the attributes with a TTL, replaced in turn from next */
+	struct tinyiiod_cache_entry cache[IIOD_CACHE_SIZE];
+	unsigned int cache_next;
+
+	/* Compressed context XML returned by ops->get_zxml */
+	const char *zxml;
+	size_t zxml_len;
+
+	/* Binary framing, enabled by the BINARY command */
+	bool binary;
+	char hdr[IIOD_BINARY_HEADER_SIZE];
+	uint32_t client_id;
+	uint32_t op;
+};
+
+void * tinyiiod_malloc(struct tinyiiod *iiod, size_t size);
+void tinyiiod_free(struct tinyiiod *iiod, void *ptr);
 
 ssize_t tinyiiod_write_char(struct tinyiiod *iiod, char c);
-ssize_t tinyiiod_write(struct tinyiiod *iiod, const char *data, size_t len);
-ssize_t tinyiiod_write_string(struct tinyiiod *iiod, const char *str);
-ssize_t tinyiiod_write_value(struct tinyiiod *iiod, int32_t value);
+ssize_t tinyiiod_flush(struct tinyiiod *iiod);
 
+int32_t tinyiiod_get_xml(struct tinyiiod *iiod);
 void tinyiiod_write_xml(struct tinyiiod *iiod);
+void tinyiiod_write_zxml(struct tinyiiod *iiod);
 
+/* attr is NULL to read all the attributes, or can list several of them
+ * separated by spaces */
 void tinyiiod_do_read_attr(struct tinyiiod *iiod, const char *device,
-			   const char *channel, bool ch_out, const char *attr, enum iio_attr_type type);
+			   const char *channel, bool ch_out, char *attr, enum iio_attr_type type);
 
 void tinyiiod_do_write_attr(struct tinyiiod *iiod, const char *device,
 			    const char *channel, bool ch_out, const char *attr,
 			    size_t bytes, enum iio_attr_type type);
 
 void tinyiiod_do_open(struct tinyiiod *iiod, const char *device,
-		      size_t sample_size, uint32_t mask);
+		      size_t sample_size, uint32_t mask, uint32_t flags);
 void tinyiiod_do_close(struct tinyiiod *iiod, const char *device);
 
 int32_t tinyiiod_do_open_instance(struct tinyiiod *iiod);
@@ -52,8 +392,94 @@ int32_t tinyiiod_do_readbuf(struct tinyiiod *iiod,
 int32_t tinyiiod_do_writebuf(struct tinyiiod *iiod, const char *device,
 			     size_t bytes_count);
 
+/* Build the registry of the context XML or of the context descriptor
+ * unless it is there already */
+int32_t tinyiiod_get_registry(struct tinyiiod *iiod);
+void tinyiiod_free_registry(struct tinyiiod *iiod);
+/* As tinyiiod_attr_id(), without building the registry */
+int32_t tinyiiod_lookup_attr(struct tinyiiod *iiod, const char *device,
+			     const char *channel, bool ch_out, const char *attr,
+			     enum iio_attr_type type);
+/* Next attribute after id of the device, or of its channel, of the given
+ * type, for iterating from id -1; its name is copied to name, left empty
+ * when it does not fit in len bytes. -ENOENT once there is none left */
+int32_t tinyiiod_next_attr_name(struct tinyiiod *iiod, int32_t id,
+				const char *device, const char *channel,
+				bool ch_out, enum iio_attr_type type,
+				char *name, size_t len);
+/* Copy the value of an attribute with a TTL, read at now at the latest, to
+ * buf: -ENOENT when there is none or it has expired, -ENOSPC when it does
+ * not fit in len bytes */
+ssize_t tinyiiod_cache_get(struct tinyiiod *iiod, const char *device,
+			   const char *channel, bool ch_out, const char *attr,
+			   enum iio_attr_type type, uint32_t now,
+			   char *buf, size_t len);
+/* Keep the value of an attribute with a TTL, read at now */
+void tinyiiod_cache_put(struct tinyiiod *iiod, const char *device,
+			const char *channel, bool ch_out, const char *attr,
+			enum iio_attr_type type, uint32_t now,
+			const char *buf, size_t len);
+void tinyiiod_cache_drop(struct tinyiiod *iiod, const char *device,
+			 const char *channel, bool ch_out, const char *attr,
+			 enum iio_attr_type type);
+size_t tinyiiod_desc_xml(struct tinyiiod *iiod,
+			 const struct tinyiiod_context_desc *ctx);
+ssize_t tinyiiod_desc_read_attr(struct tinyiiod *iiod, const char *device,
+				const char *channel, bool ch_out, const char *attr,
+				enum iio_attr_type type, char *buf, size_t len);
+ssize_t tinyiiod_desc_write_attr(struct tinyiiod *iiod, const char *device,
+				 const char *channel, bool ch_out,
+				 const char *attr, enum iio_attr_type type,
+				 const char *buf, size_t len);
+
+/* Run a backend call, on the worker when there is one; iiod stays in
+ * IIOD_STATE_PENDING until done has been called, also when run returns
+ * -EINPROGRESS, until tinyiiod_complete() */
+void tinyiiod_call(struct tinyiiod *iiod,
+		   ssize_t (*run)(struct tinyiiod *iiod),
+		   void (*done)(struct tinyiiod *iiod, ssize_t ret));
+/* Call done if the worker is done, queueing the call if needed; returns false
+ * while iiod is still waiting */
+bool tinyiiod_job_complete(struct tinyiiod *iiod);
+/* Drop a queued call or wait for the worker running it, then for the
+ * backend to complete it, and drop its result */
+void tinyiiod_job_cancel(struct tinyiiod *iiod);
+
+void tinyiiod_lock(struct tinyiiod *iiod);
+void tinyiiod_unlock(struct tinyiiod *iiod);
+
+void tinyiiod_wait_start(struct tinyiiod *iiod, struct tinyiiod_wait *wait);
+/* Yield once between two polls; returns false once the wait took the
+ * timeout of the session */
+bool tinyiiod_wait_step(struct tinyiiod *iiod, struct tinyiiod_wait *wait);
+
+ssize_t tinyiiod_ring_wait(struct tinyiiod *iiod, struct tinyiiod_ring *ring,
+			   size_t min);
+void tinyiiod_ring_release(struct tinyiiod_ring *ring, size_t bytes);
+
+int32_t tinyiiod_demux_init(struct tinyiiod_demux *demux,
+			    const struct tinyiiod_frame_layout *layout,
+			    uint32_t mask);
+bool tinyiiod_demux_needed(const struct tinyiiod_demux *demux);
+void tinyiiod_demux(const struct tinyiiod_demux *demux,
+		    char *dst, const char *src, size_t frames);
+
+/* Decimal or hexadecimal representations, NUL-terminated; the length is
+ * returned. A 64-bit value takes at most IIOD_FORMAT_SIZE bytes. */
+#define IIOD_FORMAT_SIZE 21
+size_t tinyiiod_format_u64(char *buf, uint64_t value);
+size_t tinyiiod_format_i32(char *buf, int32_t value);
+size_t tinyiiod_format_hex(char *buf, uint64_t value, unsigned int digits);
+int32_t tinyiiod_parse_u32(const char *str, char **end,
+			   uint32_t base, uint32_t *value);
+
+const char * tinyiiod_command_name(uint32_t op);
 int32_t tinyiiod_parse_string(struct tinyiiod *iiod, char *str);
+int32_t tinyiiod_parse_binary(struct tinyiiod *iiod, uint32_t op, char *args);
 
+int32_t tinyiiod_do_stats(struct tinyiiod *iiod);
 int32_t tinyiiod_set_timeout(struct tinyiiod *iiod, uint32_t timeout);
+void tinyiiod_budget_start(struct tinyiiod *iiod);
+bool tinyiiod_budget_expired(struct tinyiiod *iiod);
 
 #endif /* TINYIIOD_PRIVATE_H */
@@ -19,170 +19,1579 @@
 
 #include "compat.h"
 
-struct tinyiiod {
-	struct tinyiiod_ops *ops;
-	char *buf;
+/* Instances never exceed what callers reserve for them */
+typedef char tinyiiod_struct_size_check
+	[sizeof(struct tinyiiod) <= TINYIIOD_STRUCT_SIZE ? 1 : -1];
+
+/* Storage of an instance being created: carved from the memory of the
+ * config when there is some, otherwise allocated, from the heap unless
+ * no_heap is set */
+struct tinyiiod_mem {
+	char *ptr, *end;
+	const struct tinyiiod_allocator *allocator;
+	bool no_heap;
 };
 
-struct tinyiiod * tinyiiod_create(struct tinyiiod_ops *ops)
+static void * tinyiiod_mem_get(struct tinyiiod_mem *mem, size_t size)
+{
+	size_t pad;
+	char *ptr;
+
+	if (!mem->ptr) {
+		if (mem->allocator)
+			return mem->allocator->alloc(mem->allocator->priv, size);
+
+		return mem->no_heap ? NULL : malloc(size);
+	}
+
+	pad = (TINYIIOD_MEM_ALIGN - (size_t) mem->ptr % TINYIIOD_MEM_ALIGN) %
+	      TINYIIOD_MEM_ALIGN;
+	if (size + pad > (size_t) (mem->end - mem->ptr))
+		return NULL;
+
+	ptr = mem->ptr + pad;
+	mem->ptr = ptr + size;
+
+	return ptr;
+}
+
+void * tinyiiod_malloc(struct tinyiiod *iiod, size_t size)
+{
+	const struct tinyiiod_allocator *allocator = iiod->allocator;
+
+	if (allocator)
+		return allocator->alloc(allocator->priv, size);
+
+	/* Given static memory and no allocator, the heap is never used */
+	if (iiod->static_mem)
+		return NULL;
+
+	return malloc(size);
+}
+
+void tinyiiod_free(struct tinyiiod *iiod, void *ptr)
+{
+	const struct tinyiiod_allocator *allocator = iiod->allocator;
+
+	if (!ptr)
+		return;
+
+	if (allocator)
+		allocator->free(allocator->priv, ptr);
+	else
+		free(ptr);
+}
+
+/* Release memory obtained with tinyiiod_mem_get() */
+static void tinyiiod_mem_put(struct tinyiiod *iiod, void *ptr)
+{
+	if (!iiod->static_mem)
+		tinyiiod_free(iiod, ptr);
+}
+
+static void tinyiiod_apply_config(struct tinyiiod *iiod,
+				  const struct tinyiiod_config *config)
+{
+	iiod->buf_size = IIOD_BUFFER_SIZE;
+	iiod->rx_size = IIOD_RX_BUFFER_SIZE;
+	iiod->tx_size = IIOD_TX_BUFFER_SIZE;
+	iiod->line_size = IIOD_LINE_SIZE;
+	if (config) {
+		if (config->buf_size)
+			iiod->buf_size = config->buf_size;
+		if (config->rx_size)
+			iiod->rx_size = config->rx_size;
+		if (config->tx_size)
+			iiod->tx_size = config->tx_size;
+		if (config->line_size)
+			iiod->line_size = config->line_size;
+		iiod->block_size = config->block_size;
+		iiod->buf = config->buf;
+	}
+}
+
+size_t tinyiiod_mem_size(const struct tinyiiod_config *config)
+{
+	size_t buf_size = IIOD_BUFFER_SIZE, rx_size = IIOD_RX_BUFFER_SIZE;
+	size_t tx_size = IIOD_TX_BUFFER_SIZE, line_size = IIOD_LINE_SIZE;
+
+	if (config) {
+		if (config->buf)
+			buf_size = 0;
+		else if (config->buf_size)
+			buf_size = config->buf_size;
+		if (config->rx_size)
+			rx_size = config->rx_size;
+		if (config->tx_size)
+			tx_size = config->tx_size;
+		if (config->line_size)
+			line_size = config->line_size;
+	}
+
+	return TINYIIOD_MEM_ALIGN * 5 + sizeof(struct tinyiiod) + buf_size +
+	       rx_size + tx_size + line_size;
+}
+
+/* A session, whose root is set, takes after its allocator and, without
+ * one, does not use the heap either when the root is in static memory */
+static struct tinyiiod * tinyiiod_alloc(struct tinyiiod_ops *ops,
+				const struct tinyiiod_config *config,
+				const struct tinyiiod_session_ops *session_ops,
+				const struct tinyiiod *root)
+{
+	struct tinyiiod_mem mem = { NULL, NULL, NULL, false };
+	struct tinyiiod *iiod;
+
+	if (root) {
+		mem.allocator = root->allocator;
+		mem.no_heap = root->static_mem;
+	}
+
+	if (config && config->allocator)
+		mem.allocator = config->allocator;
+	if (config && config->mem) {
+		mem.ptr = config->mem;
+		mem.end = mem.ptr + config->mem_size;
+	}
+
+	iiod = tinyiiod_mem_get(&mem, sizeof(*iiod));
+	if (!iiod)
+		return NULL;
+
+	memset(iiod, 0, sizeof(*iiod));
+	iiod->ops = ops;
+	iiod->root = iiod;
+	iiod->session_ops = session_ops;
+	iiod->allocator = mem.allocator;
+	iiod->static_mem = !!mem.ptr;
+	tinyiiod_apply_config(iiod, config);
+
+	/* Room is needed for at least one character and the trailing \n */
+	if (iiod->buf_size < 2 || iiod->line_size < 2)
+		goto err_free_iiod;
+
+	if (!iiod->block_size)
+		iiod->block_size = iiod->buf_size;
+
+	iiod->own_buf = !iiod->buf;
+	if (iiod->own_buf) {
+		iiod->buf = tinyiiod_mem_get(&mem, iiod->buf_size);
+		if (!iiod->buf)
+			goto err_free_iiod;
+	}
+
+	/* Also keeps what tinyiiod_feed() receives while a command waits */
+	iiod->rx_buf = tinyiiod_mem_get(&mem, iiod->rx_size);
+	if (!iiod->rx_buf)
+		goto err_free_buf;
+
+	if (iiod->tx_size) {
+		iiod->tx_buf = tinyiiod_mem_get(&mem, iiod->tx_size);
+		if (!iiod->tx_buf)
+			goto err_free_rx_buf;
+	}
+
+	iiod->line = tinyiiod_mem_get(&mem, iiod->line_size);
+	if (!iiod->line)
+		goto err_free_tx_buf;
+
+	return iiod;
+
+err_free_tx_buf:
+	tinyiiod_mem_put(iiod, iiod->tx_buf);
+err_free_rx_buf:
+	tinyiiod_mem_put(iiod, iiod->rx_buf);
+err_free_buf:
+	if (iiod->own_buf)
+		tinyiiod_mem_put(iiod, iiod->buf);
+err_free_iiod:
+	tinyiiod_mem_put(iiod, iiod);
+	return NULL;
+}
+
+struct tinyiiod * tinyiiod_create(struct tinyiiod_ops *ops)
+{
+	return tinyiiod_create_ext(ops, NULL);
+}
+
+struct tinyiiod * tinyiiod_create_ext(struct tinyiiod_ops *ops,
+				      const struct tinyiiod_config *config)
+{
+	return tinyiiod_alloc(ops, config, NULL, NULL);
+}
+
+struct tinyiiod * tinyiiod_session_create(struct tinyiiod *iiod,
+		const struct tinyiiod_session_ops *ops, void *priv,
+		const struct tinyiiod_config *config)
+{
+	struct tinyiiod *session = tinyiiod_alloc(iiod->ops, config, ops,
+						  iiod->root);
+
+	if (!session)
+		return NULL;
+
+	session->root = iiod->root;
+	session->priv = priv;
+
+	return session;
+}
+
+/* Wait for the blocks the last WRITEBUF to the device left playing */
+static int32_t tinyiiod_drain(struct tinyiiod *iiod,
+			      struct tinyiiod_open_dev *dev)
+{
+	int32_t ret = 0;
+
+	while (ret >= 0 && dev->waited < dev->queued) {
+		size_t bytes = dev->queued - dev->waited > dev->block_size ?
+			       dev->block_size : dev->queued - dev->waited;
+
+		ret = (int32_t) iiod->ops->transfer_mem_to_dev_wait(dev->name,
+				dev->waited, bytes);
+		dev->waited += bytes;
+	}
+
+	dev->waited = 0;
+	dev->queued = 0;
+
+	return ret;
+}
+
+static int32_t tinyiiod_release_dev(struct tinyiiod *iiod,
+				    struct tinyiiod_open_dev *dev)
+{
+	int32_t ret = tinyiiod_drain(iiod, dev);
+
+	if (iiod->ops->close) {
+		int32_t err = iiod->ops->close(dev->name);
+
+		if (ret >= 0)
+			ret = err;
+	}
+	dev->owner = NULL;
+
+	return ret;
+}
+
+void tinyiiod_destroy(struct tinyiiod *iiod)
+{
+	struct tinyiiod *root = iiod->root;
+	uint32_t i;
+
+	tinyiiod_job_cancel(iiod);
+
+	/* Release the devices the client left open */
+	for (i = 0; i < IIOD_MAX_OPEN_DEVICES; i++) {
+		if (root->open_devs[i].owner == iiod)
+			tinyiiod_release_dev(iiod, &root->open_devs[i]);
+	}
+
+	if (root == iiod)
+		tinyiiod_invalidate_xml(iiod);
+	tinyiiod_mem_put(iiod, iiod->line);
+	tinyiiod_mem_put(iiod, iiod->tx_buf);
+	tinyiiod_mem_put(iiod, iiod->rx_buf);
+	if (iiod->own_buf)
+		tinyiiod_mem_put(iiod, iiod->buf);
+	tinyiiod_mem_put(iiod, iiod);
+}
+
+void tinyiiod_register_commands(struct tinyiiod *iiod,
+				const struct tinyiiod_command *commands,
+				size_t count)
+{
+	iiod->root->commands = commands;
+	iiod->root->num_commands = count;
+}
+
+static void put_le32(char *buf, uint32_t value)
+{
+	buf[0] = (char) (value & 0xff);
+	buf[1] = (char) ((value >> 8) & 0xff);
+	buf[2] = (char) ((value >> 16) & 0xff);
+	buf[3] = (char) ((value >> 24) & 0xff);
+}
+
+static void put_be32(char *buf, uint32_t value)
+{
+	buf[0] = (char) ((value >> 24) & 0xff);
+	buf[1] = (char) ((value >> 16) & 0xff);
+	buf[2] = (char) ((value >> 8) & 0xff);
+	buf[3] = (char) (value & 0xff);
+}
+
+static void put_le64(char *buf, uint64_t value)
+{
+	put_le32(buf, (uint32_t) (value & 0xffffffff));
+	put_le32(buf + 4, (uint32_t) (value >> 32));
+}
+
+static uint32_t get_le32(const char *buf)
+{
+	const unsigned char *ptr = (const unsigned char *) buf;
+
+	return (uint32_t) ptr[0] | (uint32_t) ptr[1] << 8 |
+	       (uint32_t) ptr[2] << 16 | (uint32_t) ptr[3] << 24;
+}
+
+static ssize_t io_read(struct tinyiiod *iiod, char *buf, size_t len)
+{
+	if (iiod->session_ops)
+		return iiod->session_ops->read(iiod->priv, buf, len);
+
+	return iiod->ops->read(buf, len);
+}
+
+static ssize_t io_read_partial(struct tinyiiod *iiod, char *buf, size_t len)
+{
+	if (iiod->session_ops)
+		return iiod->session_ops->read_partial(iiod->priv, buf, len);
+
+	return iiod->ops->read_partial(buf, len);
+}
+
+static ssize_t io_write(struct tinyiiod *iiod, const char *buf, size_t len)
+{
+	if (iiod->session_ops)
+		return iiod->session_ops->write(iiod->priv, buf, len);
+
+	return iiod->ops->write(buf, len);
+}
+
+static bool io_has_read_partial(struct tinyiiod *iiod)
+{
+	if (iiod->session_ops)
+		return !!iiod->session_ops->read_partial;
+
+	return !!iiod->ops->read_partial;
+}
+
+static bool io_has_writev(struct tinyiiod *iiod)
+{
+	if (iiod->session_ops)
+		return !!iiod->session_ops->writev;
+
+	return !!iiod->ops->writev;
+}
+
+static ssize_t io_writev(struct tinyiiod *iiod,
+			 const struct tinyiiod_span *spans, unsigned int count)
+{
+	if (iiod->session_ops)
+		return iiod->session_ops->writev(iiod->priv, spans, count);
+
+	return iiod->ops->writev(spans, count);
+}
+
+static struct tinyiiod_open_dev * tinyiiod_find_open_dev(struct tinyiiod *iiod,
+		const char *device)
+{
+	struct tinyiiod *root = iiod->root;
+	uint32_t i;
+
+	for (i = 0; i < IIOD_MAX_OPEN_DEVICES; i++) {
+		if (root->open_devs[i].owner &&
+		    !strcmp(root->open_devs[i].name, device))
+			return &root->open_devs[i];
+	}
+
+	return NULL;
+}
+
+static uint32_t tinyiiod_cycles(struct tinyiiod *iiod)
+{
+	return iiod->ops->get_cycles ? iiod->ops->get_cycles() : 0;
+}
+
+static void tinyiiod_account(struct tinyiiod *iiod)
+{
+	struct tinyiiod_cmd_stats *stats = &iiod->stats[iiod->cmd];
+	uint32_t cycles = tinyiiod_cycles(iiod) - iiod->cmd_start;
+
+	stats->count++;
+	stats->bytes_in += iiod->cmd_in;
+	stats->bytes_out += iiod->cmd_out;
+	stats->cycles += cycles;
+	if (cycles > stats->max_cycles)
+		stats->max_cycles = cycles;
+
+	iiod->measuring = false;
+}
+
+static void tinyiiod_finish(struct tinyiiod *iiod, int32_t ret)
+{
+	if (iiod->measuring)
+		tinyiiod_account(iiod);
+
+	iiod->state = iiod->binary ? IIOD_STATE_BINARY_HEADER : IIOD_STATE_LINE;
+	iiod->count = 0;
+	iiod->found = false;
+	iiod->ret = ret;
+	iiod->done = true;
+}
+
+static void tinyiiod_command_done(struct tinyiiod *iiod, int32_t ret)
+{
+	if (ret < 0)
+		tinyiiod_write_value(iiod, ret);
+	tinyiiod_flush(iiod);
+	tinyiiod_finish(iiod, ret);
+}
+
+static void tinyiiod_run_command(struct tinyiiod *iiod)
+{
+	int32_t ret;
+
+	/* Unknown and registered commands are counted together */
+	iiod->cmd = IIOD_CMD_COUNT;
+	iiod->cmd_in = iiod->binary ? IIOD_BINARY_HEADER_SIZE + iiod->count :
+		       iiod->count;
+	iiod->cmd_out = 0;
+	iiod->cmd_start = tinyiiod_cycles(iiod);
+	iiod->measuring = true;
+
+	iiod->state = IIOD_STATE_RUN;
+	if (iiod->binary)
+		ret = tinyiiod_parse_binary(iiod, iiod->op, iiod->line);
+	else
+		ret = tinyiiod_parse_string(iiod, iiod->line);
+
+	/* Commands expecting a payload complete once it has been received */
+	if (iiod->state == IIOD_STATE_RUN)
+		tinyiiod_command_done(iiod, ret);
+}
+
+static size_t tinyiiod_process_line(struct tinyiiod *iiod,
+				    const char *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		char ch = data[i];
+
+		if (iiod->count < iiod->line_size)
+			iiod->line[iiod->count] = ch;
+		iiod->count++;
+
+		if (ch != '\n') {
+			iiod->found = true;
+			continue;
+		}
+
+		if (!iiod->found)
+			continue;
+
+		if (iiod->count > iiod->line_size) {
+			/* No \n found in the buffer -> garbage data */
+			tinyiiod_finish(iiod, -EIO);
+		} else {
+			iiod->line[iiod->count - 2] = '\0';
+			tinyiiod_run_command(iiod);
+		}
+
+		return i + 1;
+	}
+
+	return len;
+}
+
+static void tinyiiod_store(char *dst, const char *data, size_t len)
+{
+	/* The blocking reader places the data where it belongs */
+	if (dst != data)
+		memcpy(dst, data, len);
+}
+
+static size_t tinyiiod_process_binary_header(struct tinyiiod *iiod,
+		const char *data, size_t len)
+{
+	size_t bytes = IIOD_BINARY_HEADER_SIZE - iiod->count;
+
+	if (bytes > len)
+		bytes = len;
+
+	tinyiiod_store(iiod->hdr + iiod->count, data, bytes);
+	iiod->count += bytes;
+	if (iiod->count < IIOD_BINARY_HEADER_SIZE)
+		return bytes;
+
+	iiod->client_id = get_le32(iiod->hdr) & 0xffff;
+	iiod->op = (unsigned char) iiod->hdr[2];
+	iiod->xfer.bytes = get_le32(iiod->hdr + 4);
+	iiod->count = 0;
+
+	if (iiod->xfer.bytes) {
+		iiod->state = IIOD_STATE_BINARY_ARGS;
+	} else {
+		iiod->line[0] = '\0';
+		tinyiiod_run_command(iiod);
+	}
+
+	return bytes;
+}
+
+static size_t tinyiiod_process_binary_args(struct tinyiiod *iiod,
+		const char *data, size_t len)
+{
+	size_t bytes = iiod->xfer.bytes - iiod->count;
+	bool fits = iiod->xfer.bytes < iiod->line_size;
+
+	if (bytes > len)
+		bytes = len;
+
+	/* Arguments too long are dropped to stay in sync with the client */
+	if (fits)
+		tinyiiod_store(iiod->line + iiod->count, data, bytes);
+	iiod->count += bytes;
+	if (iiod->count < iiod->xfer.bytes)
+		return bytes;
+
+	if (fits) {
+		iiod->line[iiod->xfer.bytes] = '\0';
+		tinyiiod_run_command(iiod);
+	} else {
+		tinyiiod_command_done(iiod, -EINVAL);
+	}
+
+	return bytes;
+}
+
+/* Values that do not fit in the transfer buffer go to the write_attr_chunk
+ * op, one buffer at a time */
+static bool tinyiiod_write_attr_streamed(struct tinyiiod *iiod)
+{
+	return iiod->xfer.bytes > iiod->buf_size - 1;
+}
+
+static ssize_t tinyiiod_write_attr_op(struct tinyiiod *iiod)
+{
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+	size_t bytes = xfer->bytes;
+	int32_t id;
+
+	iiod->buf[bytes] = '\0';
+
+	if (iiod->ops->context)
+		return tinyiiod_desc_write_attr(iiod, xfer->device,
+						xfer->channel, xfer->ch_out,
+						xfer->attr, xfer->type,
+						iiod->buf, bytes);
+
+	if (iiod->ops->write_attr_id) {
+		id = tinyiiod_lookup_attr(iiod, xfer->device, xfer->channel,
+					  xfer->ch_out, xfer->attr, xfer->type);
+		if (id < 0)
+			return id;
+
+		return iiod->ops->write_attr_id((uint32_t) id, iiod->buf, bytes);
+	}
+
+	if (xfer->channel)
+		return iiod->ops->ch_write_attr(xfer->device, xfer->channel,
+						xfer->ch_out, xfer->attr,
+						iiod->buf, bytes);
+
+	return iiod->ops->write_attr(xfer->device, xfer->attr,
+				     iiod->buf, bytes, xfer->type);
+}
+
+static ssize_t tinyiiod_write_attr_value(struct tinyiiod *iiod)
+{
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+
+	tinyiiod_cache_drop(iiod, xfer->device, xfer->channel, xfer->ch_out,
+			    xfer->attr, xfer->type);
+
+	if (!tinyiiod_write_attr_streamed(iiod))
+		return tinyiiod_write_attr_op(iiod);
+	if (iiod->ops->write_attr_chunk)
+		return xfer->err;
+
+	return -EFBIG;
+}
+
+static void tinyiiod_write_attr_done(struct tinyiiod *iiod, ssize_t ret)
+{
+	tinyiiod_write_value(iiod, (int32_t) ret);
+	tinyiiod_command_done(iiod, 0);
+}
+
+static void tinyiiod_write_attr_end(struct tinyiiod *iiod)
+{
+	tinyiiod_call(iiod, tinyiiod_write_attr_value,
+		      tinyiiod_write_attr_done);
+}
+
+/* Pass the chunk held in iiod->buf, ending at iiod->count */
+static ssize_t tinyiiod_write_attr_chunk(struct tinyiiod *iiod)
+{
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+	size_t offset = (iiod->count - 1) / iiod->buf_size * iiod->buf_size;
+
+	/* After an error, the rest of the value is dropped */
+	if (xfer->err < 0)
+		return xfer->err;
+
+	return iiod->ops->write_attr_chunk(xfer->device, xfer->channel,
+					   xfer->ch_out, xfer->attr, xfer->type,
+					   iiod->buf, offset,
+					   iiod->count - offset, xfer->bytes);
+}
+
+static void tinyiiod_write_attr_chunk_done(struct tinyiiod *iiod, ssize_t ret)
+{
+	iiod->xfer.err = (int32_t) ret;
+	iiod->state = IIOD_STATE_WRITE_ATTR;
+
+	if (iiod->count == iiod->xfer.bytes)
+		tinyiiod_write_attr_end(iiod);
+}
+
+static size_t tinyiiod_process_write_attr(struct tinyiiod *iiod,
+		const char *data, size_t len)
+{
+	size_t bytes = iiod->xfer.bytes - iiod->count;
+	size_t pos;
+
+	if (bytes > len)
+		bytes = len;
+
+	if (!tinyiiod_write_attr_streamed(iiod)) {
+		tinyiiod_store(iiod->buf + iiod->count, data, bytes);
+		iiod->count += bytes;
+	} else if (iiod->ops->write_attr_chunk) {
+		pos = iiod->count % iiod->buf_size;
+		if (bytes > iiod->buf_size - pos)
+			bytes = iiod->buf_size - pos;
+
+		tinyiiod_store(iiod->buf + pos, data, bytes);
+		iiod->count += bytes;
+		if (iiod->count % iiod->buf_size == 0 ||
+		    iiod->count == iiod->xfer.bytes) {
+			/* The rest of the value waits for the chunk */
+			tinyiiod_call(iiod, tinyiiod_write_attr_chunk,
+				      tinyiiod_write_attr_chunk_done);
+			return bytes;
+		}
+	} else {
+		/* Dropped, to stay in sync with the client */
+		iiod->count += bytes;
+	}
+
+	if (iiod->count == iiod->xfer.bytes)
+		tinyiiod_write_attr_end(iiod);
+
+	return bytes;
+}
+
+static bool tinyiiod_writebuf_pipelined(struct tinyiiod *iiod)
+{
+	return iiod->ops->transfer_mem_to_dev_start &&
+	       iiod->ops->transfer_mem_to_dev_wait;
+}
+
+/* Wait for the pipelined blocks of the WRITEBUF started but not waited for
+ * yet, also after an error; returns the first error */
+static int32_t tinyiiod_writebuf_wait(struct tinyiiod *iiod)
+{
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+	size_t block = xfer->dev ? xfer->dev->block_size : iiod->block_size;
+	int32_t ret = 0, err;
+
+	while (xfer->waited < xfer->accepted) {
+		size_t bytes = xfer->accepted - xfer->waited > block ?
+			       block : xfer->accepted - xfer->waited;
+
+		err = (int32_t) iiod->ops->transfer_mem_to_dev_wait(xfer->device,
+				xfer->waited, bytes);
+		if (err < 0 && ret >= 0)
+			ret = err;
+		xfer->waited += bytes;
+	}
+
+	return ret;
+}
+
+static void tinyiiod_writebuf_done(struct tinyiiod *iiod)
+{
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+	struct tinyiiod_open_dev *dev = xfer->dev;
+	int32_t ret = xfer->err, err;
+
+	/* Past its budget, the buffer is cut to what the device got */
+	if (ret == -ETIMEDOUT && xfer->accepted) {
+		xfer->bytes = xfer->accepted;
+		ret = 0;
+	}
+
+	if (tinyiiod_writebuf_pipelined(iiod) && dev) {
+		/* Played while the client goes on, e.g. with the READBUF
+		 * of another device; waited for by the next WRITEBUF or
+		 * CLOSE of this one, also after an error */
+		dev->waited = xfer->waited;
+		dev->queued = xfer->accepted;
+	} else if (tinyiiod_writebuf_pipelined(iiod) && !dev) {
+		/* After an error, the blocks started are still waited for:
+		 * the next command reuses their memory */
+		err = tinyiiod_writebuf_wait(iiod);
+		if (ret >= 0)
+			ret = err;
+	} else if (ret >= 0 && iiod->ops->transfer_mem_to_dev) {
+		ret = iiod->ops->transfer_mem_to_dev(xfer->device, xfer->bytes);
+	}
+	if (ret >= 0) {
+		if (dev)
+			dev->pushed = true;
+		tinyiiod_write_value(iiod, (int32_t) xfer->bytes);
+	}
+
+	tinyiiod_command_done(iiod, ret);
+}
+
+static int32_t tinyiiod_write_data(struct tinyiiod *iiod, const char *data,
+				   size_t offset, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = iiod->ops->write_data(iiod->xfer.device, data, offset, len);
+		if (ret <= 0)
+			return ret < 0 ? (int32_t) ret : -EIO;
+
+		data += ret;
+		offset += (size_t) ret;
+		len -= (size_t) ret;
+	}
+
+	return 0;
+}
+
+/* Hand every block to the device as soon as it is complete, waiting for a
+ * block to be played before the backend reuses its memory */
+static int32_t tinyiiod_write_blocks(struct tinyiiod *iiod, const char *data,
+				     size_t len)
+{
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+	size_t block = xfer->dev ? xfer->dev->block_size : iiod->block_size;
+	size_t depth = IIOD_PIPELINE_DEPTH * block, pos = iiod->count;
+	int32_t ret;
+
+	while (len) {
+		size_t start = pos - pos % block;
+		size_t end = start + block > xfer->bytes ? xfer->bytes : start + block;
+		size_t bytes = end - pos > len ? len : end - pos;
+
+		if (pos == start && start >= depth) {
+			ret = iiod->ops->transfer_mem_to_dev_wait(xfer->device,
+					start - depth, block);
+			xfer->waited = start - depth + block;
+			if (ret < 0)
+				return ret;
+		}
+
+		ret = tinyiiod_write_data(iiod, data, pos, bytes);
+		if (ret < 0)
+			return ret;
+
+		pos += bytes;
+		data += bytes;
+		len -= bytes;
+		if (pos == end) {
+			ret = iiod->ops->transfer_mem_to_dev_start(xfer->device,
+					start, end - start);
+			if (ret < 0)
+				return ret;
+			xfer->accepted = end;
+		}
+	}
+
+	return 0;
+}
+
+static size_t tinyiiod_process_writebuf(struct tinyiiod *iiod,
+					const char *data, size_t len)
+{
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+	size_t bytes = xfer->bytes - iiod->count;
+
+	if (bytes > len)
+		bytes = len;
+
+	if (xfer->err >= 0 && tinyiiod_budget_expired(iiod))
+		xfer->err = -ETIMEDOUT;
+
+	/* After an error, the rest of the payload is received and dropped,
+	 * so that the next command is found where the client sends it */
+	if (xfer->err >= 0) {
+		if (tinyiiod_writebuf_pipelined(iiod)) {
+			xfer->err = tinyiiod_write_blocks(iiod, data, bytes);
+		} else {
+			xfer->err = tinyiiod_write_data(iiod, data,
+							iiod->count, bytes);
+			if (xfer->err >= 0)
+				xfer->accepted = iiod->count + bytes;
+		}
+	}
+	iiod->count += bytes;
+
+	if (iiod->count == xfer->bytes)
+		tinyiiod_writebuf_done(iiod);
+
+	return bytes;
+}
+
+/* Consume the bytes that belong to the command being received, running it
+ * once complete; returns how many bytes were consumed */
+static size_t tinyiiod_process(struct tinyiiod *iiod,
+			       const char *data, size_t len)
+{
+	switch (iiod->state) {
+	case IIOD_STATE_BINARY_HEADER:
+		return tinyiiod_process_binary_header(iiod, data, len);
+	case IIOD_STATE_BINARY_ARGS:
+		return tinyiiod_process_binary_args(iiod, data, len);
+	case IIOD_STATE_WRITE_ATTR:
+		return tinyiiod_process_write_attr(iiod, data, len);
+	case IIOD_STATE_WRITEBUF:
+		return tinyiiod_process_writebuf(iiod, data, len);
+	case IIOD_STATE_PENDING:
+		return 0;
+	default:
+		return tinyiiod_process_line(iiod, data, len);
+	}
+}
+
+/* Where the blocking reader should store the next bytes, and how many can
+ * be read without reaching into the next command */
+static size_t tinyiiod_input_buffer(struct tinyiiod *iiod, char **buf)
+{
+	size_t bytes = iiod->xfer.bytes - iiod->count;
+
+	switch (iiod->state) {
+	case IIOD_STATE_BINARY_HEADER:
+		*buf = iiod->hdr + iiod->count;
+		return IIOD_BINARY_HEADER_SIZE - iiod->count;
+	case IIOD_STATE_BINARY_ARGS:
+		if (iiod->xfer.bytes < iiod->line_size) {
+			*buf = iiod->line + iiod->count;
+			return bytes;
+		}
+		break;
+	case IIOD_STATE_WRITE_ATTR:
+		if (!tinyiiod_write_attr_streamed(iiod)) {
+			*buf = iiod->buf + iiod->count;
+			return bytes;
+		}
+		if (iiod->ops->write_attr_chunk) {
+			size_t pos = iiod->count % iiod->buf_size;
+
+			*buf = iiod->buf + pos;
+			return bytes > iiod->buf_size - pos ?
+			       iiod->buf_size - pos : bytes;
+		}
+		break;
+	case IIOD_STATE_WRITEBUF:
+		break;
+	default:
+		/* One byte at a time, so that no payload is read */
+		*buf = iiod->buf;
+		return 1;
+	}
+
+	*buf = iiod->buf;
+	return bytes > iiod->buf_size ? iiod->buf_size : bytes;
+}
+
+int32_t tinyiiod_read_command(struct tinyiiod *iiod)
+{
+	ssize_t ret;
+	size_t len;
+	char *buf;
+
+	iiod->done = false;
+	while (!iiod->done) {
+		if (iiod->state == IIOD_STATE_PENDING) {
+			struct tinyiiod_wait wait;
+
+			tinyiiod_flush(iiod);
+			tinyiiod_wait_start(iiod, &wait);
+			while (!tinyiiod_job_complete(iiod)) {
+				/* Still pending, waited for again by the next
+				 * call */
+				if (!tinyiiod_wait_step(iiod, &wait))
+					return -ETIMEDOUT;
+			}
+			continue;
+		}
+
+		/* Bytes read ahead go through the state machine first */
+		if (iiod->rx_start < iiod->rx_end) {
+			iiod->rx_start += tinyiiod_process(iiod,
+							   iiod->rx_buf + iiod->rx_start,
+							   iiod->rx_end - iiod->rx_start);
+			continue;
+		}
+
+		/* The client may be waiting for a reply before sending more */
+		tinyiiod_flush(iiod);
+
+		if (iiod->state == IIOD_STATE_LINE) {
+			if (!iiod->session_ops && iiod->ops->read_line) {
+				ret = iiod->ops->read_line(iiod->line,
+							   iiod->line_size);
+				if (ret < 0)
+					return (int32_t) ret;
+
+				iiod->count = (size_t) ret;
+				tinyiiod_run_command(iiod);
+				continue;
+			}
+
+			if (io_has_read_partial(iiod)) {
+				ret = io_read_partial(iiod, iiod->rx_buf,
+						      iiod->rx_size);
+				if (ret <= 0)
+					break;
+
+				iiod->rx_start = 0;
+				iiod->rx_end = (size_t) ret;
+				continue;
+			}
+		}
+
+		len = tinyiiod_input_buffer(iiod, &buf);
+		ret = io_read(iiod, buf, len);
+		if (ret <= 0)
+			break;
+
+		tinyiiod_process(iiod, buf, (size_t) ret);
+	}
+
+	if (!iiod->done && ret == -ETIMEDOUT) {
+		/* The client is slow, not gone: the command goes on with the
+		 * next call, a transfer past its budget */
+		iiod->expired = true;
+		return -ETIMEDOUT;
+	}
+
+	if (!iiod->done) {
+		/* The client is gone, start afresh with the next one */
+		tinyiiod_finish(iiod, -EIO);
+		return -EIO;
+	}
+
+	return iiod->ret;
+}
+
+/* Keep data for when the command left to the worker is complete */
+static int32_t tinyiiod_hold(struct tinyiiod *iiod, const char *data,
+			     size_t len)
+{
+	if (len > iiod->rx_size - iiod->rx_end) {
+		memmove(iiod->rx_buf, iiod->rx_buf + iiod->rx_start,
+			iiod->rx_end - iiod->rx_start);
+		iiod->rx_end -= iiod->rx_start;
+		iiod->rx_start = 0;
+	}
+
+	/* Clients wait for responses, only a misbehaving one gets here */
+	if (len > iiod->rx_size - iiod->rx_end)
+		return -ENOBUFS;
+
+	memcpy(iiod->rx_buf + iiod->rx_end, data, len);
+	iiod->rx_end += len;
+
+	return 0;
+}
+
+int32_t tinyiiod_feed(struct tinyiiod *iiod, const char *data, size_t len)
+{
+	size_t bytes;
+
+	/* Behind the command left to the worker and what was kept since */
+	if (iiod->state == IIOD_STATE_PENDING ||
+	    iiod->rx_start < iiod->rx_end) {
+		if (tinyiiod_hold(iiod, data, len) < 0)
+			return -ENOBUFS;
+
+		tinyiiod_poll(iiod);
+		return iiod->ret;
+	}
+
+	iiod->done = false;
+	iiod->ret = 0;
+	while (len && iiod->state != IIOD_STATE_PENDING) {
+		bytes = tinyiiod_process(iiod, data, len);
+		data += bytes;
+		len -= bytes;
+	}
+
+	if (len && tinyiiod_hold(iiod, data, len) < 0)
+		return -ENOBUFS;
+
+	/* Send what is ready, the client may wait for it before sending more */
+	tinyiiod_flush(iiod);
+
+	return iiod->ret;
+}
+
+int32_t tinyiiod_poll(struct tinyiiod *iiod)
+{
+	iiod->done = false;
+	iiod->ret = 0;
+
+	if (!tinyiiod_job_complete(iiod))
+		return -EINPROGRESS;
+
+	while (iiod->rx_start < iiod->rx_end &&
+	       iiod->state != IIOD_STATE_PENDING)
+		iiod->rx_start += tinyiiod_process(iiod,
+						   iiod->rx_buf + iiod->rx_start,
+						   iiod->rx_end - iiod->rx_start);
+
+	tinyiiod_flush(iiod);
+
+	return iiod->state == IIOD_STATE_PENDING ? -EINPROGRESS : iiod->ret;
+}
+
+ssize_t tinyiiod_write_char(struct tinyiiod *iiod, char c)
+{
+	return tinyiiod_write(iiod, &c, 1);
+}
+
+ssize_t tinyiiod_write(struct tinyiiod *iiod, const char *data, size_t len)
+{
+	iiod->cmd_out += len;
+
+	if (!iiod->tx_buf)
+		return io_write(iiod, data, len);
+
+	if (len > iiod->tx_size - iiod->tx_len)
+		tinyiiod_flush(iiod);
+
+	/* Too big to be worth a copy */
+	if (len >= iiod->tx_size)
+		return io_write(iiod, data, len);
+
+	memcpy(iiod->tx_buf + iiod->tx_len, data, len);
+	iiod->tx_len += len;
+
+	return (ssize_t) len;
+}
+
+ssize_t tinyiiod_flush(struct tinyiiod *iiod)
+{
+	ssize_t ret;
+
+	if (!iiod->tx_len)
+		return 0;
+
+	ret = io_write(iiod, iiod->tx_buf, iiod->tx_len);
+	iiod->tx_len = 0;
+
+	return ret;
+}
+
+ssize_t tinyiiod_writev(struct tinyiiod *iiod,
+			const struct tinyiiod_span *spans, unsigned int count)
+{
+	struct tinyiiod_span all[IIOD_MAX_SPANS + 1];
+	unsigned int i, n = 0;
+	size_t len = 0;
+	ssize_t ret;
+
+	if (!io_has_writev(iiod) || count > IIOD_MAX_SPANS) {
+		for (i = 0; i < count; i++) {
+			ret = tinyiiod_write(iiod, spans[i].buf, spans[i].len);
+			if (ret < 0)
+				return ret;
+			len += spans[i].len;
+		}
+
+		return (ssize_t) len;
+	}
+
+	for (i = 0; i < count; i++)
+		len += spans[i].len;
+
+	/* Small responses are still coalesced */
+	if (iiod->tx_buf && len <= iiod->tx_size - iiod->tx_len) {
+		for (i = 0; i < count; i++)
+			tinyiiod_write(iiod, spans[i].buf, spans[i].len);
+		return (ssize_t) len;
+	}
+
+	iiod->cmd_out += len;
+
+	/* What was coalesced so far goes first */
+	if (iiod->tx_len) {
+		all[n].buf = iiod->tx_buf;
+		all[n++].len = iiod->tx_len;
+		iiod->tx_len = 0;
+	}
+
+	for (i = 0; i < count; i++)
+		if (spans[i].len)
+			all[n++] = spans[i];
+
+	return io_writev(iiod, all, n);
+}
+
+ssize_t tinyiiod_write_string(struct tinyiiod *iiod, const char *str)
+{
+	return tinyiiod_write(iiod, str, strlen(str));
+}
+
+/* The header of a response carrying value; returns its length */
+static size_t tinyiiod_format_value(struct tinyiiod *iiod, char *buf,
+				    int32_t value)
+{
+	size_t len;
+
+	if (iiod->binary) {
+		put_le32(buf, iiod->client_id);
+		buf[2] = (char) iiod->op;
+		buf[3] = 0;
+		put_le32(buf + 4, (uint32_t) value);
+		return IIOD_BINARY_HEADER_SIZE;
+	}
+
+	len = tinyiiod_format_i32(buf, value);
+	buf[len++] = '\n';
+	return len;
+}
+
+ssize_t tinyiiod_write_value(struct tinyiiod *iiod, int32_t value)
+{
+	char buf[16];
+
+	return tinyiiod_write(iiod, buf, tinyiiod_format_value(iiod, buf, value));
+}
+
+/* Write the length of data, data and in text mode a newline */
+static ssize_t tinyiiod_write_payload(struct tinyiiod *iiod,
+				      const char *data, size_t len)
+{
+	struct tinyiiod_span spans[3];
+	char buf[16];
+
+	spans[0].buf = buf;
+	spans[0].len = tinyiiod_format_value(iiod, buf, (int32_t) len);
+	spans[1].buf = data;
+	spans[1].len = len;
+	spans[2].buf = "\n";
+	spans[2].len = iiod->binary ? 0 : 1;
+
+	return tinyiiod_writev(iiod, spans, 3);
+}
+
+void tinyiiod_invalidate_xml(struct tinyiiod *iiod)
+{
+	struct tinyiiod *root = iiod->root;
+
+	char *xml;
+
+	/* The names of the registry point into the XML */
+	tinyiiod_free_registry(iiod);
+
+	tinyiiod_lock(iiod);
+	xml = root->xml;
+	root->xml = NULL;
+	root->xml_len = 0;
+	root->zxml = NULL;
+	root->zxml_len = 0;
+	tinyiiod_unlock(iiod);
+
+	free(xml);
+}
+
+int32_t tinyiiod_get_xml(struct tinyiiod *iiod)
+{
+	struct tinyiiod *root = iiod->root;
+	char *xml = NULL;
+	ssize_t ret;
+
+	if (root->xml)
+		return 0;
+
+	ret = iiod->ops->get_xml(&xml);
+	if (ret < 0)
+		return (int32_t) ret;
+	if (!xml)
+		return -ENOENT;
+
+	root->xml = xml;
+	root->xml_len = strlen(xml);
+
+	return 0;
+}
+
+void tinyiiod_write_xml(struct tinyiiod *iiod)
+{
+	const struct tinyiiod_context_desc *ctx = iiod->ops->context;
+	struct tinyiiod *root = iiod->root;
+	int32_t ret;
+
+	if (ctx) {
+		/* Streamed as it is generated, the first pass only counts */
+		tinyiiod_write_value(iiod, (int32_t) tinyiiod_desc_xml(NULL, ctx));
+		tinyiiod_desc_xml(iiod, ctx);
+		if (!iiod->binary)
+			tinyiiod_write_char(iiod, '\n');
+		return;
+	}
+
+	ret = tinyiiod_get_xml(iiod);
+	if (ret < 0) {
+		tinyiiod_write_value(iiod, ret);
+		return;
+	}
+
+	tinyiiod_write_payload(iiod, root->xml, root->xml_len);
+}
+
+void tinyiiod_write_zxml(struct tinyiiod *iiod)
 {
-	struct tinyiiod *iiod = malloc(sizeof(*iiod));
+	struct tinyiiod *root = iiod->root;
 
-	if (!iiod)
-		return NULL;
+	if (!root->zxml) {
+		const char *zxml = NULL;
+		ssize_t ret = -ENOSYS;
 
-	iiod->buf = malloc(IIOD_BUFFER_SIZE);
-	if (!iiod->buf) {
-		free(iiod);
-		return NULL;
+		/* Clients fall back to PRINT on error */
+		if (iiod->ops->get_zxml)
+			ret = iiod->ops->get_zxml(&zxml);
+		if (ret <= 0 || !zxml) {
+			tinyiiod_write_value(iiod, ret < 0 ? (int32_t) ret : -ENOENT);
+			return;
+		}
+
+		root->zxml = zxml;
+		root->zxml_len = (size_t) ret;
 	}
-	iiod->ops = ops;
 
-	return iiod;
+	tinyiiod_write_payload(iiod, root->zxml, root->zxml_len);
 }
 
-void tinyiiod_destroy(struct tinyiiod *iiod)
+static ssize_t tinyiiod_read_attr_op(struct tinyiiod *iiod,
+				     const char *device, const char *channel,
+				     bool ch_out, const char *attr,
+				     enum iio_attr_type type,
+				     char *buf, size_t len)
 {
-	free(iiod->buf);
-	free(iiod);
+	int32_t id;
+
+	if (iiod->ops->context)
+		return tinyiiod_desc_read_attr(iiod, device, channel, ch_out,
+					       attr, type, buf, len);
+
+	if (iiod->ops->read_attr_id) {
+		id = tinyiiod_lookup_attr(iiod, device, channel, ch_out, attr,
+					  type);
+		if (id < 0)
+			return id;
+
+		return iiod->ops->read_attr_id((uint32_t) id, buf, len);
+	}
+
+	if (channel)
+		return iiod->ops->ch_read_attr(device, channel,
+					       ch_out, attr, buf, len);
+
+	return iiod->ops->read_attr(device, attr, buf, len, type);
 }
 
-int32_t tinyiiod_read_command(struct tinyiiod *iiod)
+static ssize_t tinyiiod_read_attr(struct tinyiiod *iiod, const char *device,
+				  const char *channel, bool ch_out,
+				  const char *attr, enum iio_attr_type type,
+				  char *buf, size_t len)
 {
-	char buf[128];
-	int32_t ret;
+	uint32_t now = 0;
+	ssize_t ret;
 
-	ret = tinyiiod_read_line(iiod, buf, sizeof(buf));
-	if (ret < 0)
+	/* Read before the lock is taken, the value is then stamped with the
+	 * time of the request */
+	if (iiod->ops->get_time_ms)
+		now = iiod->ops->get_time_ms();
+
+	ret = tinyiiod_cache_get(iiod, device, channel, ch_out, attr, type,
+				 now, buf, len);
+	if (ret != -ENOENT)
 		return ret;
 
-	ret = tinyiiod_parse_string(iiod, buf);
-	if (ret < 0)
-		tinyiiod_write_value(iiod, ret);
+	ret = tinyiiod_read_attr_op(iiod, device, channel, ch_out, attr,
+				    type, buf, len);
+	if (ret >= 0 && (size_t) ret <= len)
+		tinyiiod_cache_put(iiod, device, channel, ch_out, attr, type,
+				   now, buf, (size_t) ret);
 
 	return ret;
 }
 
-ssize_t tinyiiod_read(struct tinyiiod *iiod, char *buf, size_t len)
-{
-	return iiod->ops->read(buf, len);
-}
-
-ssize_t tinyiiod_read_line(struct tinyiiod *iiod, char *buf, size_t len)
+/* End the entry of an attribute of a batched response at xfer->pos, in the
+ * format of libiio's read_all: a big-endian length, negative on error,
+ * followed by the NUL-terminated value padded to 4 bytes */
+static int32_t tinyiiod_put_attr_entry(struct tinyiiod *iiod, ssize_t ret)
 {
-	char ch;
-	uint32_t i;
-	bool found = false;
-	int32_t ret;
-
-	if (iiod->ops->read_line)
-		return iiod->ops->read_line(buf, len);
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+	size_t room = iiod->buf_size - 1 - xfer->pos;
+	char *ptr = iiod->buf + xfer->pos;
 
-	for (i = 0; i < len - 1; i++) {
-		ret = iiod->ops->read(&ch, 1);
-		if (ret <= 0)
-			return -EIO;
-		buf[i] = ch;
-		if (buf[i] != '\n')
-			found = true;
-		else if (found)
-			break;
+	if (ret < 0) {
+		put_be32(ptr, (uint32_t) ret);
+		xfer->pos += 4;
+		return 0;
 	}
 
-	if (!found || i == len - 1) {
-		/* No \n found -> garbage data */
-		return -EIO;
-	}
+	/* Room for the NUL and the padding */
+	if ((size_t) ret + 4 > room - 4)
+		return -ENOSPC;
 
-	buf[i - 1] = '\0';
+	ptr[4 + ret++] = '\0';
+	put_be32(ptr, (uint32_t) ret);
+	for (; ret & 0x3; ret++)
+		ptr[4 + ret] = '\0';
+	xfer->pos += 4 + (size_t) ret;
 
-	return i;
+	return 0;
 }
 
-ssize_t tinyiiod_write_char(struct tinyiiod *iiod, char c)
+static int32_t tinyiiod_read_attr_entry(struct tinyiiod *iiod, const char *attr)
 {
-	return iiod->ops->write(&c, 1);
-}
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+	size_t room = iiod->buf_size - 1 - xfer->pos;
+	ssize_t ret;
 
-ssize_t tinyiiod_write(struct tinyiiod *iiod, const char *data, size_t len)
-{
-	return iiod->ops->write(data, len);
+	if (room < 8)
+		return -ENOSPC;
+
+	/* Set first, the backend can complete the attribute before its op
+	 * returns -EINPROGRESS */
+	xfer->deferred = true;
+	ret = tinyiiod_read_attr(iiod, xfer->device, xfer->channel,
+				 xfer->ch_out, attr, xfer->type,
+				 iiod->buf + xfer->pos + 4, room - 4);
+	if (ret == -EINPROGRESS)
+		return -EINPROGRESS;
+
+	xfer->deferred = false;
+	return tinyiiod_put_attr_entry(iiod, ret);
 }
 
-ssize_t tinyiiod_write_string(struct tinyiiod *iiod, const char *str)
+/* Read the attributes of a batch from xfer->next, a space-separated list of
+ * names, or from the one after xfer->id for all the attributes of the
+ * device, or of the channel, of the given type. Stops at an attribute whose
+ * op returned -EINPROGRESS, to go on from the next one */
+static ssize_t tinyiiod_read_attrs(struct tinyiiod *iiod)
 {
-	return tinyiiod_write(iiod, str, strlen(str));
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+	char name[IIOD_LINE_SIZE], *attr;
+	int32_t ret = 0;
+
+	if (xfer->attr) {
+		while (xfer->next && !ret) {
+			attr = xfer->next;
+			xfer->next = strchr(attr, ' ');
+			if (xfer->next)
+				*xfer->next++ = '\0';
+
+			ret = tinyiiod_read_attr_entry(iiod, attr);
+		}
+
+		return ret < 0 ? ret : (ssize_t) xfer->pos;
+	}
+
+	while (!ret) {
+		ret = tinyiiod_next_attr_name(iiod, xfer->id, xfer->device,
+					      xfer->channel, xfer->ch_out,
+					      xfer->type, name, sizeof(name));
+		if (ret == -ENOENT)
+			return (ssize_t) xfer->pos;
+		if (ret < 0)
+			return ret;
+
+		/* Only the entry of a name too long to be copied fails */
+		xfer->id = ret;
+		if (*name)
+			ret = tinyiiod_read_attr_entry(iiod, name);
+		else if (iiod->buf_size - 1 - xfer->pos < 4)
+			ret = -ENOSPC;
+		else
+			ret = tinyiiod_put_attr_entry(iiod, -ENAMETOOLONG);
+	}
+
+	return ret;
 }
 
-ssize_t tinyiiod_write_value(struct tinyiiod *iiod, int32_t value)
+static ssize_t tinyiiod_read_attr_value(struct tinyiiod *iiod)
 {
-	char buf[16];
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
 
-	snprintf(buf, sizeof(buf), "%"PRIi32"\n", value);
-	return tinyiiod_write_string(iiod, buf);
+	if (xfer->batch)
+		return tinyiiod_read_attrs(iiod);
+
+	return tinyiiod_read_attr(iiod, xfer->device, xfer->channel,
+				  xfer->ch_out, xfer->attr, xfer->type,
+				  iiod->buf, iiod->buf_size - 1);
 }
 
-void tinyiiod_write_xml(struct tinyiiod *iiod)
+static void tinyiiod_read_attr_done(struct tinyiiod *iiod, ssize_t ret)
 {
-	char *xml;
-	iiod->ops->get_xml(&xml);
-	size_t len = strlen(xml);
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+
+	/* An attribute of the batch completed later, on to the next ones */
+	if (xfer->deferred) {
+		xfer->deferred = false;
+		ret = tinyiiod_put_attr_entry(iiod, ret);
+		if (ret >= 0) {
+			tinyiiod_call(iiod, tinyiiod_read_attr_value,
+				      tinyiiod_read_attr_done);
+			return;
+		}
+	}
+
+	if (ret > 0)
+		tinyiiod_write_payload(iiod, iiod->buf, (size_t) ret);
+	else
+		tinyiiod_write_value(iiod, (int32_t) ret);
 
-	tinyiiod_write_value(iiod, len);
-	tinyiiod_write(iiod, xml, len);
-	tinyiiod_write_char(iiod, '\n');
+	tinyiiod_command_done(iiod, 0);
 }
 
 void tinyiiod_do_read_attr(struct tinyiiod *iiod, const char *device,
-			   const char *channel, bool ch_out, const char *attr, enum iio_attr_type type)
+			   const char *channel, bool ch_out, char *attr,
+			   enum iio_attr_type type)
 {
-	ssize_t ret;
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
 
-	if (channel)
-		ret = iiod->ops->ch_read_attr(device, channel,
-					      ch_out, attr, iiod->buf, IIOD_BUFFER_SIZE);
-	else
-		ret = iiod->ops->read_attr(device, attr,
-					   iiod->buf, IIOD_BUFFER_SIZE, type);
+	xfer->device = device;
+	xfer->channel = channel;
+	xfer->ch_out = ch_out;
+	xfer->attr = attr;
+	xfer->type = type;
+	xfer->batch = !attr || strchr(attr, ' ');
+	xfer->next = attr;
+	xfer->id = -1;
+	xfer->pos = 0;
+	xfer->deferred = false;
 
-	tinyiiod_write_value(iiod, (int32_t) ret);
-	if (ret > 0) {
-		iiod->buf[ret] = '\n';
-		tinyiiod_write(iiod, iiod->buf, (size_t) ret + 1);
-	}
+	tinyiiod_call(iiod, tinyiiod_read_attr_value, tinyiiod_read_attr_done);
 }
 
 void tinyiiod_do_write_attr(struct tinyiiod *iiod, const char *device,
 			    const char *channel, bool ch_out, const char *attr,
 			    size_t bytes, enum iio_attr_type type)
 {
-	ssize_t ret;
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
 
-	if (bytes > IIOD_BUFFER_SIZE - 1)
-		bytes = IIOD_BUFFER_SIZE - 1;
+	/* The strings live in iiod->line, left untouched until the value has
+	 * been received */
+	xfer->device = device;
+	xfer->channel = channel;
+	xfer->ch_out = ch_out;
+	xfer->attr = attr;
+	xfer->type = type;
+	xfer->bytes = bytes;
+	xfer->err = 0;
+	iiod->cmd_in += bytes;
 
-	tinyiiod_read(iiod, iiod->buf, bytes);
-	iiod->buf[bytes] = '\0';
+	iiod->state = IIOD_STATE_WRITE_ATTR;
+	iiod->count = 0;
+	if (!bytes)
+		tinyiiod_write_attr_end(iiod);
+}
 
-	if (channel)
-		ret = iiod->ops->ch_write_attr(device, channel, ch_out,
-					       attr, iiod->buf, bytes);
-	else
-		ret = iiod->ops->write_attr(device, attr, iiod->buf, bytes, type);
+/* Blocks of the pipelined transfers of a device hold whole frames, and no
+ * more than its buffer of samples_count frames when it is known */
+static size_t tinyiiod_open_block_size(struct tinyiiod *iiod,
+				       const char *device,
+				       size_t samples_count, uint32_t mask)
+{
+	struct tinyiiod_frame_layout layout;
+	struct tinyiiod_demux demux;
+	size_t block = iiod->block_size;
 
-	tinyiiod_write_value(iiod, (int32_t) ret);
+	if (!iiod->ops->get_frame_layout ||
+	    iiod->ops->get_frame_layout(device, &layout) < 0 ||
+	    tinyiiod_demux_init(&demux, &layout, mask) < 0)
+		return block;
+
+	if (samples_count && block > samples_count * demux.hw_frame)
+		block = samples_count * demux.hw_frame;
+
+	block -= block % demux.hw_frame;
+
+	return block ? block : demux.hw_frame;
 }
 
 void tinyiiod_do_open(struct tinyiiod *iiod, const char *device,
-		      size_t sample_size, uint32_t mask)
+		      size_t sample_size, uint32_t mask, uint32_t flags)
 {
-	int32_t ret = iiod->ops->open(device, sample_size, mask);
+	struct tinyiiod_open_dev *dev = tinyiiod_find_open_dev(iiod, device);
+	struct tinyiiod *root = iiod->root;
+	struct tinyiiod_ring *ring = NULL;
+	uint32_t i;
+	int32_t ret;
+
+	if (dev && dev->owner != iiod) {
+		/* Opened by another session */
+		ret = -EBUSY;
+	} else {
+		/* Without a free slot or room for its name, the device is
+		 * opened untracked, straight through the ops: no flag is
+		 * emulated and READBUF does not use its capture ring */
+		for (i = 0; !dev && strlen(device) < sizeof(dev->name) &&
+		     i < IIOD_MAX_OPEN_DEVICES; i++) {
+			if (!root->open_devs[i].owner)
+				dev = &root->open_devs[i];
+		}
+
+		if (iiod->ops->open_ext)
+			ret = iiod->ops->open_ext(device, sample_size, mask, flags);
+		else if (flags & ~(dev ? IIOD_OPEN_EMULATED : 0))
+			ret = -ENOSYS;
+		else
+			ret = iiod->ops->open(device, sample_size, mask);
+
+		if (ret >= 0 && dev && iiod->ops->get_ring) {
+			ret = iiod->ops->get_ring(device, &ring);
+			if (ret < 0 && iiod->ops->close)
+				iiod->ops->close(device);
+		}
+
+		if (ret >= 0 && dev) {
+			strcpy(dev->name, device);
+			dev->owner = iiod;
+			dev->flags = flags;
+			dev->mask = mask;
+			dev->position = 0;
+			dev->pushed = false;
+			dev->ring = ring;
+			dev->overflows = ring ? ring->overflows : 0;
+			dev->samples_count = sample_size;
+			dev->block_size = tinyiiod_open_block_size(iiod, device,
+								   sample_size,
+								   mask);
+			dev->waited = 0;
+			dev->queued = 0;
+		}
+	}
+
 	tinyiiod_write_value(iiod, ret);
 }
 
 void tinyiiod_do_close(struct tinyiiod *iiod, const char *device)
 {
-	int32_t ret = iiod->ops->close(device);
+	struct tinyiiod_open_dev *dev = tinyiiod_find_open_dev(iiod, device);
+	int32_t ret;
+
+	if (dev && dev->owner != iiod)
+		ret = -EBUSY;
+	else if (dev)
+		ret = tinyiiod_release_dev(iiod, dev);
+	else
+		ret = iiod->ops->close(device);
+
 	tinyiiod_write_value(iiod, ret);
 }
 
@@ -205,82 +1614,500 @@ int32_t tinyiiod_do_close_instance(struct tinyiiod *iiod)
 int32_t tinyiiod_do_writebuf(struct tinyiiod *iiod,
 			     const char *device, size_t bytes_count)
 {
-	size_t bytes, offset = 0, total_bytes = bytes_count;
-	char buf[256];
-	int32_t ret = 0;
+	struct tinyiiod_open_dev *dev = tinyiiod_find_open_dev(iiod, device);
+	struct tinyiiod_xfer *xfer = &iiod->xfer;
+
+	if (dev && dev->owner != iiod)
+		return -EBUSY;
+
+	/* The device keeps replaying the first buffer pushed */
+	if (dev && (dev->flags & TINYIIOD_OPEN_CYCLIC) && dev->pushed)
+		return -EBUSY;
 
 	tinyiiod_write_value(iiod, bytes_count);
-	while (bytes_count) {
-		bytes = bytes_count > sizeof(buf) ? sizeof(buf) : bytes_count;
-		ret = tinyiiod_read(iiod, buf, bytes);
-		if (ret > 0) {
-			ret = iiod->ops->write_data(device, buf, offset, ret);
-			offset += ret;
-			if (ret < 0)
-				return ret;
-			bytes_count -= ret;
-		} else
-			return ret;
+
+	xfer->device = device;
+	xfer->dev = dev;
+	xfer->bytes = bytes_count;
+	iiod->cmd_in += bytes_count;
+	xfer->waited = 0;
+	xfer->accepted = 0;
+	tinyiiod_budget_start(iiod);
+
+	/* The memory of the previous buffer is about to be reused */
+	xfer->err = dev ? tinyiiod_drain(iiod, dev) : 0;
+
+	iiod->state = IIOD_STATE_WRITEBUF;
+	iiod->count = 0;
+	if (!bytes_count)
+		tinyiiod_writebuf_done(iiod);
+
+	return 0;
+}
+
+/* Point *data at up to bytes of captured data found at offset, packed when
+ * demux is set, and return how many bytes were read from the device */
+static ssize_t tinyiiod_get_data(struct tinyiiod *iiod, const char *device,
+				 const struct tinyiiod_demux *demux,
+				 const char **data, size_t offset, size_t bytes)
+{
+	ssize_t ret = -ENOENT;
+	size_t frames;
+
+	if (!demux) {
+		if (iiod->ops->get_data)
+			return iiod->ops->get_data(device, data, offset, bytes);
+
+		*data = iiod->buf;
+		return iiod->ops->read_data(device, iiod->buf, offset,
+					    bytes > iiod->buf_size ?
+					    iiod->buf_size : bytes);
+	}
+
+	/* Only whole frames, as many as fit in the buffer */
+	frames = iiod->buf_size / demux->hw_frame;
+	if (bytes / demux->hw_frame < frames)
+		frames = bytes / demux->hw_frame;
+	bytes = frames * demux->hw_frame;
+
+	if (iiod->ops->get_data)
+		ret = iiod->ops->get_data(device, data, offset, bytes);
+	if (ret < (ssize_t) demux->hw_frame && iiod->ops->read_data) {
+		*data = iiod->buf;
+		ret = iiod->ops->read_data(device, iiod->buf, offset, bytes);
+	}
+	if (ret < (ssize_t) demux->hw_frame)
+		return ret < 0 ? ret : -EIO;
+
+	frames = (size_t) ret / demux->hw_frame;
+	tinyiiod_demux(demux, iiod->buf, *data, frames);
+	*data = iiod->buf;
+
+	return (ssize_t) (frames * demux->hw_frame);
+}
+
+static size_t tinyiiod_format_block_info(struct tinyiiod *iiod, char *buf,
+					 const struct tinyiiod_block_info *info,
+					 uint64_t position)
+{
+	size_t len;
+
+	if (iiod->binary) {
+		put_le64(buf, info->timestamp);
+		put_le64(buf + 8, position);
+		put_le32(buf + 16, info->overflow ? 1 : 0);
+		return IIOD_BLOCK_META_SIZE;
+	}
+
+	len = tinyiiod_format_hex(buf, info->timestamp, 16);
+	buf[len++] = ' ';
+	len += tinyiiod_format_u64(buf + len, position);
+	buf[len++] = ' ';
+	buf[len++] = info->overflow ? '1' : '0';
+	buf[len++] = '\n';
+
+	return len;
+}
+
+/* Send a chunk of READBUF, preceded by the mask for the first chunk and by
+ * info when it is the first chunk of a block; dev is set when the metadata
+ * of the blocks is wanted */
+static void tinyiiod_send_chunk(struct tinyiiod *iiod,
+				struct tinyiiod_open_dev *dev,
+				const char *data, size_t sent,
+				uint32_t mask, bool *print_mask,
+				const struct tinyiiod_block_info *info)
+{
+	struct tinyiiod_span spans[4];
+	char buf[16], buf_mask[10], buf_info[48];
+	unsigned int count = 0;
+
+	spans[count].buf = buf;
+	spans[count++].len = tinyiiod_format_value(iiod, buf, (int32_t) sent);
+
+	if (*print_mask) {
+		spans[count].buf = buf_mask;
+		if (iiod->binary) {
+			put_le32(buf_mask, mask);
+			spans[count++].len = 4;
+		} else {
+			tinyiiod_format_hex(buf_mask, mask, 8);
+			buf_mask[8] = '\n';
+			spans[count++].len = 9;
+		}
+		*print_mask = false;
+	}
+
+	if (dev && info) {
+		spans[count].buf = buf_info;
+		spans[count++].len = tinyiiod_format_block_info(iiod, buf_info,
+								info,
+								dev->position);
 	}
-	if (iiod->ops->transfer_mem_to_dev) {
-		ret = iiod->ops->transfer_mem_to_dev(device, total_bytes);
+	if (dev)
+		dev->position += sent;
+
+	spans[count].buf = data;
+	spans[count++].len = sent;
+	tinyiiod_writev(iiod, spans, count);
+}
+
+/* Send the block found at offset; dev is set when its metadata is wanted */
+static int32_t tinyiiod_send_data(struct tinyiiod *iiod, const char *device,
+				  const struct tinyiiod_demux *demux,
+				  struct tinyiiod_open_dev *dev,
+				  size_t offset, size_t bytes_count,
+				  uint32_t mask, bool *print_mask)
+{
+	struct tinyiiod_block_info info = { 0, false };
+	bool print_info = true;
+	int32_t ret = 0;
+
+	if (dev && iiod->ops->get_block_info) {
+		ret = iiod->ops->get_block_info(device, offset, bytes_count,
+						&info);
 		if (ret < 0)
 			return ret;
 	}
-	tinyiiod_write_value(iiod, (int) total_bytes);
+
+	while (bytes_count) {
+		const char *data;
+		size_t sent;
+
+		if (tinyiiod_budget_expired(iiod))
+			return -ETIMEDOUT;
+
+		ret = (int32_t) tinyiiod_get_data(iiod, device, demux, &data,
+						  offset, bytes_count);
+		if (ret <= 0)
+			return ret < 0 ? ret : -EIO;
+
+		sent = demux ? (size_t) ret / demux->hw_frame * demux->frame :
+		       (size_t) ret;
+		offset += (size_t) ret;
+
+		tinyiiod_send_chunk(iiod, dev, data, sent, mask, print_mask,
+				    print_info ? &info : NULL);
+		print_info = false;
+		bytes_count -= (size_t) ret;
+	}
 
 	return ret;
 }
 
+/* Send the data of the ring of a device as the backend produces them; dev
+ * is set when their metadata is wanted */
+static int32_t tinyiiod_readbuf_ring(struct tinyiiod *iiod, const char *device,
+				     struct tinyiiod_open_dev *open,
+				     const struct tinyiiod_demux *demux,
+				     struct tinyiiod_open_dev *dev,
+				     size_t bytes_count, uint32_t mask,
+				     bool *print_mask)
+{
+	struct tinyiiod_ring *ring = open->ring;
+	struct tinyiiod_block_info info = { 0, false };
+	size_t min = demux ? demux->hw_frame : 1;
+	bool print_info = true;
+	uint32_t overflows;
+	ssize_t ret;
+
+	if (dev && iiod->ops->get_block_info) {
+		ret = iiod->ops->get_block_info(device, ring->tail, bytes_count,
+						&info);
+		if (ret < 0)
+			return (int32_t) ret;
+	}
+
+	/* Samples lost since the previous READBUF */
+	overflows = ring->overflows;
+	if (overflows != open->overflows) {
+		info.overflow = true;
+		open->overflows = overflows;
+	}
+
+	while (bytes_count) {
+		const char *data = ring->buf + ring->tail;
+		size_t bytes, sent;
+
+		ret = tinyiiod_ring_wait(iiod, ring, min);
+		if (ret < 0)
+			return (int32_t) ret;
+
+		bytes = (size_t) ret < bytes_count ? (size_t) ret : bytes_count;
+		sent = bytes;
+
+		if (demux) {
+			size_t frames = bytes / demux->hw_frame;
+
+			if (frames > iiod->buf_size / demux->hw_frame)
+				frames = iiod->buf_size / demux->hw_frame;
+
+			tinyiiod_demux(demux, iiod->buf, data, frames);
+			data = iiod->buf;
+			bytes = frames * demux->hw_frame;
+			sent = frames * demux->frame;
+		}
+
+		tinyiiod_send_chunk(iiod, dev, data, sent, mask, print_mask,
+				    print_info ? &info : NULL);
+		print_info = false;
+
+		/* Sent, the producer can reuse the memory */
+		tinyiiod_ring_release(ring, bytes);
+		bytes_count -= bytes;
+	}
+
+	return 0;
+}
+
+static int32_t tinyiiod_readbuf_pipelined(struct tinyiiod *iiod,
+		const char *device, const struct tinyiiod_demux *demux,
+		struct tinyiiod_open_dev *dev, size_t block,
+		size_t bytes_count, uint32_t mask, bool *print_mask)
+{
+	size_t offset, next = 0;
+	int32_t ret, err = 0;
+	uint32_t i;
+
+	/* Blocks hold whole frames */
+	if (demux) {
+		block -= block % demux->hw_frame;
+		if (!block)
+			block = demux->hw_frame;
+	}
+
+	for (i = 0; i < IIOD_PIPELINE_DEPTH && next < bytes_count; i++) {
+		size_t bytes = bytes_count - next > block ? block : bytes_count - next;
+
+		err = iiod->ops->transfer_dev_to_mem_start(device, next, bytes);
+		if (err < 0)
+			break;
+		next += bytes;
+	}
+
+	for (offset = 0; offset < next; offset += block) {
+		size_t bytes = bytes_count - offset > block ?
+			       block : bytes_count - offset;
+
+		ret = iiod->ops->transfer_dev_to_mem_wait(device, offset, bytes);
+		if (ret < 0 && err >= 0)
+			err = ret;
+
+		/* After an error or past the budget, the blocks started are
+		 * only waited for: the next command reuses their memory */
+		if (err < 0)
+			continue;
+
+		/* The next blocks are captured while this one is sent */
+		err = tinyiiod_send_data(iiod, device, demux, dev, offset,
+					 bytes, mask, print_mask);
+		if (err < 0)
+			continue;
+
+		/* Only now is the memory of this block free for reuse */
+		if (next < bytes_count) {
+			bytes = bytes_count - next > block ? block : bytes_count - next;
+			err = iiod->ops->transfer_dev_to_mem_start(device, next, bytes);
+			if (err >= 0)
+				next += bytes;
+		}
+	}
+
+	return err;
+}
+
+/* Set up the packing of the enabled channels; returns 1 when they need
+ * packing, 0 when the frames only hold them already */
+static int32_t tinyiiod_readbuf_demux(struct tinyiiod *iiod, const char *device,
+				      struct tinyiiod_demux *demux,
+				      uint32_t *mask)
+{
+	struct tinyiiod_open_dev *dev = tinyiiod_find_open_dev(iiod, device);
+	struct tinyiiod_frame_layout layout;
+	int32_t ret;
+
+	ret = iiod->ops->get_frame_layout(device, &layout);
+	if (ret < 0)
+		return ret;
+
+	/* The channels the client asked for */
+	if (dev)
+		*mask = dev->mask;
+
+	ret = tinyiiod_demux_init(demux, &layout, *mask);
+	if (ret < 0)
+		return ret;
+
+	if (demux->hw_frame > iiod->buf_size)
+		return -ENOMEM;
+
+	return tinyiiod_demux_needed(demux);
+}
+
 int32_t tinyiiod_do_readbuf(struct tinyiiod *iiod,
 			    const char *device, size_t bytes_count)
 {
+	struct tinyiiod_open_dev *open = tinyiiod_find_open_dev(iiod, device);
+	struct tinyiiod_open_dev *dev = open;
+	struct tinyiiod_demux demux, *pdemux = NULL;
 	int32_t ret;
-	char buf[256];
 	uint32_t mask;
 	bool print_mask = true;
-	size_t offset = 0;
+
+	if (open && open->owner != iiod)
+		return -EBUSY;
+
+	if (dev && !(dev->flags & TINYIIOD_OPEN_METADATA))
+		dev = NULL;
 
 	ret = iiod->ops->get_mask(device, &mask);
 	if (ret < 0) {
 		return ret;
 	}
-	if (iiod->ops->transfer_dev_to_mem) {
-		ret = iiod->ops->transfer_dev_to_mem(device, bytes_count);
-		if (ret < 0)
-			return ret;
-	}
-	while (bytes_count) {
-		size_t bytes = bytes_count > sizeof(buf) ? sizeof(buf) : bytes_count;
 
-		ret = (int) iiod->ops->read_data(device, buf, offset, bytes);
-		offset += bytes;
-		tinyiiod_write_value(iiod, ret);
+	if (iiod->ops->get_frame_layout) {
+		ret = tinyiiod_readbuf_demux(iiod, device, &demux, &mask);
 		if (ret < 0)
 			return ret;
 
-		if (print_mask) {
-			char buf_mask[10];
+		/* Counted in full frames from now on, which only a whole
+		 * number of packed ones maps to */
+		if (ret) {
+			if (bytes_count % demux.frame)
+				return -EINVAL;
 
-			snprintf(buf_mask, sizeof(buf_mask), "%08"PRIx32"\n", mask);
-			tinyiiod_write_string(iiod, buf_mask);
-			print_mask = false;
+			pdemux = &demux;
+			bytes_count = bytes_count / demux.frame * demux.hw_frame;
 		}
+	}
 
-		tinyiiod_write(iiod, buf, (size_t) ret);
-		bytes_count -= (size_t) ret;
+	tinyiiod_budget_start(iiod);
+
+	if (open && open->ring) {
+		ret = tinyiiod_readbuf_ring(iiod, device, open, pdemux, dev,
+					    bytes_count, mask, &print_mask);
+	} else if (iiod->ops->transfer_dev_to_mem_start &&
+		   iiod->ops->transfer_dev_to_mem_wait) {
+		ret = tinyiiod_readbuf_pipelined(iiod, device, pdemux, dev,
+						 open ? open->block_size :
+						 iiod->block_size,
+						 bytes_count, mask, &print_mask);
+	} else {
+		if (iiod->ops->transfer_dev_to_mem) {
+			ret = iiod->ops->transfer_dev_to_mem(device, bytes_count);
+			if (ret < 0)
+				return ret;
+		}
+
+		ret = tinyiiod_send_data(iiod, device, pdemux, dev, 0,
+					 bytes_count, mask, &print_mask);
+	}
+
+	/* Past its budget, the buffer is cut to what was sent: an empty
+	 * chunk ends it */
+	if (ret == -ETIMEDOUT && !print_mask) {
+		tinyiiod_write_value(iiod, 0);
+		return 0;
 	}
 
 	return ret;
 }
 
+const struct tinyiiod_cmd_stats * tinyiiod_get_stats(struct tinyiiod *iiod,
+						     unsigned int *count)
+{
+	*count = IIOD_STATS_COUNT;
+
+	return iiod->stats;
+}
+
+const char * tinyiiod_stats_name(unsigned int index)
+{
+	return tinyiiod_command_name(index);
+}
+
+void tinyiiod_reset_stats(struct tinyiiod *iiod)
+{
+	memset(iiod->stats, 0, sizeof(iiod->stats));
+}
+
+/* One line per command used: name, count, bytes in and out, total and
+ * maximum cycles */
+int32_t tinyiiod_do_stats(struct tinyiiod *iiod)
+{
+	size_t len = 0, room = iiod->buf_size - 1;
+	char line[16 + 5 * IIOD_FORMAT_SIZE];
+	uint32_t i, j;
+
+	for (i = 0; i < IIOD_STATS_COUNT; i++) {
+		const struct tinyiiod_cmd_stats *stats = &iiod->stats[i];
+		const char *name = tinyiiod_command_name(i);
+		uint64_t values[5];
+		size_t bytes;
+
+		if (!stats->count)
+			continue;
+
+		values[0] = stats->count;
+		values[1] = stats->bytes_in;
+		values[2] = stats->bytes_out;
+		values[3] = stats->cycles;
+		values[4] = stats->max_cycles;
+
+		/* Command names are short; see the command table */
+		bytes = strlen(name);
+		memcpy(line, name, bytes);
+		for (j = 0; j < 5; j++) {
+			line[bytes++] = ' ';
+			bytes += tinyiiod_format_u64(line + bytes, values[j]);
+		}
+		line[bytes++] = '\n';
+
+		if (bytes > room - len)
+			return -ENOSPC;
+		memcpy(iiod->buf + len, line, bytes);
+		len += bytes;
+	}
+
+	tinyiiod_write_value(iiod, (int32_t) len);
+	tinyiiod_write(iiod, iiod->buf, len);
+	if (!iiod->binary)
+		tinyiiod_write_char(iiod, '\n');
+
+	return 0;
+}
+
 int32_t tinyiiod_set_timeout(struct tinyiiod *iiod, uint32_t timeout)
 {
 	int32_t ret = 0;
 
-	if (iiod->ops->set_timeout)
+	iiod->timeout = timeout;
+	if (iiod->session_ops) {
+		if (iiod->session_ops->set_timeout)
+			ret = iiod->session_ops->set_timeout(iiod->priv, timeout);
+	} else if (iiod->ops->set_timeout) {
 		ret = iiod->ops->set_timeout(timeout);
+	}
 	tinyiiod_write_value(iiod, ret);
 
 	return ret;
 }
+
+/* The library cannot interrupt a backend call: the budget is checked
+ * between the chunks and the blocks of a transfer */
+void tinyiiod_budget_start(struct tinyiiod *iiod)
+{
+	iiod->expired = false;
+	iiod->budgeted = iiod->timeout && iiod->ops->get_time_ms;
+	if (iiod->budgeted)
+		iiod->budget_start = iiod->ops->get_time_ms();
+}
+
+bool tinyiiod_budget_expired(struct tinyiiod *iiod)
+{
+	if (!iiod->expired && iiod->budgeted)
+		iiod->expired = iiod->ops->get_time_ms() - iiod->budget_start >=
+				iiod->timeout;
+
+	return iiod->expired;
+}
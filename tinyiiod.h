@@ -28,6 +28,134 @@ enum iio_attr_type {
 	IIO_ATTR_TYPE_BUFFER = 2,
 };
 
+enum tinyiiod_open_flags {
+	/* Output buffer replayed by the device until closed */
+	TINYIIOD_OPEN_CYCLIC = 1 << 0,
+	/* Every READBUF block is preceded by its metadata, handled by the
+	 * library; see the get_block_info op */
+	TINYIIOD_OPEN_METADATA = 1 << 1,
+};
+
+struct tinyiiod_block_info {
+	/* Capture time of the first sample of the block, in units chosen by
+	 * the backend */
+	uint64_t timestamp;
+	/* Samples were lost since the previous block */
+	bool overflow;
+};
+
+/* Orders the accesses to a ring and to its indexes, and to the queue of
+ * tinyiiod_work(); can be overridden, e.g. with __DMB() where the producer
+ * is a DMA other cores do not see */
+#ifndef TINYIIOD_RING_BARRIER
+#ifdef __GNUC__
+#define TINYIIOD_RING_BARRIER() __sync_synchronize()
+#else
+#define TINYIIOD_RING_BARRIER() do { } while (0)
+#endif
+#endif
+
+/*
+ * Single-producer single-consumer ring a device captures into while it is
+ * open, see the get_ring op. The producer, e.g. a DMA interrupt, only moves
+ * head and the library only moves tail. Both are offsets in buf; the ring is
+ * empty when they are equal, so it holds at most size - 1 bytes.
+ */
+struct tinyiiod_ring {
+	char *buf;
+	size_t size;
+	volatile size_t head;
+	volatile size_t tail;
+	/* Bytes the producer dropped because the ring was full */
+	volatile uint32_t overflows;
+};
+
+/* Attribute TTL: the value is kept until the attribute is written */
+#define TINYIIOD_TTL_STATIC 0xffffffff
+
+struct tinyiiod_device_desc;
+struct tinyiiod_channel_desc;
+
+struct tinyiiod_attr_desc {
+	const char *name;
+	/* Kind of a device attribute, ignored for channel attributes */
+	enum iio_attr_type type;
+
+	/* Either can be NULL, accesses then fail with -ENOSYS. channel is NULL
+	 * for device attributes */
+	ssize_t (*show)(const struct tinyiiod_device_desc *dev,
+			const struct tinyiiod_channel_desc *channel,
+			const struct tinyiiod_attr_desc *attr,
+			char *buf, size_t len);
+	ssize_t (*store)(const struct tinyiiod_device_desc *dev,
+			 const struct tinyiiod_channel_desc *channel,
+			 const struct tinyiiod_attr_desc *attr,
+			 const char *buf, size_t len);
+	/* Time in milliseconds during which the value returned by show is
+	 * reused, see tinyiiod_set_attr_ttl() */
+	uint32_t ttl_ms;
+	void *priv;
+};
+
+struct tinyiiod_scan_format {
+	bool is_signed;
+	bool is_be;
+	unsigned int bits;
+	unsigned int storage_bits;
+	unsigned int shift;
+	/* Number of samples of the channel in a scan, 1 when 0 */
+	unsigned int repeat;
+};
+
+struct tinyiiod_channel_desc {
+	const char *id;
+	/* Optional */
+	const char *name;
+	bool output;
+
+	/* NULL when the channel is not a scan element */
+	const struct tinyiiod_scan_format *scan;
+	unsigned int scan_index;
+
+	const struct tinyiiod_attr_desc *attrs;
+	size_t num_attrs;
+	void *priv;
+};
+
+struct tinyiiod_device_desc {
+	const char *id;
+	/* Optional */
+	const char *name;
+
+	const struct tinyiiod_channel_desc *channels;
+	size_t num_channels;
+	const struct tinyiiod_attr_desc *attrs;
+	size_t num_attrs;
+	void *priv;
+};
+
+struct tinyiiod_context_desc {
+	const char *name;
+	/* Optional */
+	const char *description;
+
+	const struct tinyiiod_device_desc *devices;
+	size_t num_devices;
+};
+
+/* Layout of the frames captured by a device, which hold every channel */
+struct tinyiiod_frame_layout {
+	/* Storage size in bytes of each channel, in scan index order */
+	const size_t *sizes;
+	unsigned int num_channels;
+};
+
+/* Part of a response given to the writev op */
+struct tinyiiod_span {
+	const char *buf;
+	size_t len;
+};
+
 struct tinyiiod_ops {
 	/* Read from the input stream */
 	ssize_t (*read)(char *buf, size_t len);
@@ -64,13 +192,356 @@ struct tinyiiod_ops {
 
 	int32_t (*get_mask)(const char *device, uint32_t *mask);
 
+	/* Timeout given by the client, also applied by the library to every
+	 * READBUF and WRITEBUF when get_time_ms is set: past it, READBUF
+	 * ends with the data sent so far and WRITEBUF replies with the bytes
+	 * the device got, the rest of the payload being dropped. Without
+	 * get_time_ms, transfers are not bounded by the library, only the
+	 * waits described with the yield op. A read of the input stream can
+	 * return -ETIMEDOUT, the command being received then goes on with
+	 * the next tinyiiod_read_command() */
 	int32_t (*set_timeout)(uint32_t timeout);
 
+	/* Return the context XML in a buffer allocated with malloc(). The
+	 * library keeps it to answer every PRINT and frees it on
+	 * tinyiiod_invalidate_xml() or tinyiiod_destroy() */
 	ssize_t (*get_xml)(char **outxml);
+
+	/* New ops go below, so that the members above keep their place */
+
+	/* Optional: write the count spans in order, as one write would.
+	 * Multi-part responses are given to it without being copied
+	 * together first; without it, the spans are written one by one */
+	ssize_t (*writev)(const struct tinyiiod_span *spans, unsigned int count);
+
+	/* Optional: read at most len bytes from the input stream, returning
+	 * as soon as some data is available. When set, command lines are
+	 * read in bulk through an internal read-ahead buffer */
+	ssize_t (*read_partial)(char *buf, size_t len);
+
+	/* Optional: receive the values too long for the transfer buffer, which
+	 * fail with -EFBIG without it. The value of bytes_count bytes comes in
+	 * chunks of at most the size of the buffer, offset being the position
+	 * of the chunk in the value; the result of the last call is the result
+	 * of the write, and an error drops the rest of the value */
+	ssize_t (*write_attr_chunk)(const char *device, const char *channel,
+				    bool ch_out, const char *attr,
+				    enum iio_attr_type type, const char *buf,
+				    size_t offset, size_t len,
+				    size_t bytes_count);
+
+	/* Optional, used in place of open when set; flags is a combination
+	 * of enum tinyiiod_open_flags. Without it, open is called for every
+	 * flag and the library still refuses a second WRITEBUF to a cyclic
+	 * buffer, unless more devices are open than it keeps track of or the
+	 * name of the device is too long: flags then fail with -ENOSYS */
+	int32_t (*open_ext)(const char *device, size_t sample_size,
+			    uint32_t mask, uint32_t flags);
+
+	/* Optional zero-copy alternative to read_data: point *buf at the
+	 * captured data found at offset and return how many contiguous bytes
+	 * (at most bytes_count) can be sent from there */
+	ssize_t (*get_data)(const char *device, const char **buf, size_t offset,
+			    size_t bytes_count);
+
+	/* Optional pipelined capture: start filling the block found at offset
+	 * and wait for it to be complete. When both are set, READBUF keeps
+	 * IIOD_PIPELINE_DEPTH blocks in flight and sends each one as soon as
+	 * it is complete, instead of calling transfer_dev_to_mem */
+	ssize_t (*transfer_dev_to_mem_start)(const char *device, size_t offset,
+					     size_t bytes_count);
+	ssize_t (*transfer_dev_to_mem_wait)(const char *device, size_t offset,
+					    size_t bytes_count);
+
+	/* Optional pipelined playback: start sending the block found at
+	 * offset to the device and wait for it to be consumed. When both are
+	 * set, WRITEBUF starts every block as soon as it has been received
+	 * and waits for a block to complete before the data of the block
+	 * IIOD_PIPELINE_DEPTH positions later is written, instead of calling
+	 * transfer_mem_to_dev once at the end */
+	ssize_t (*transfer_mem_to_dev_start)(const char *device, size_t offset,
+					     size_t bytes_count);
+	ssize_t (*transfer_mem_to_dev_wait)(const char *device, size_t offset,
+					    size_t bytes_count);
+
+	/* Optional: describe the captured block found at offset, for devices
+	 * opened with TINYIIOD_OPEN_METADATA; the timestamp is 0 without it */
+	int32_t (*get_block_info)(const char *device, size_t offset,
+				  size_t bytes_count,
+				  struct tinyiiod_block_info *info);
+
+	/* Optional: when set, read_data and get_data return full frames of
+	 * the given layout and READBUF only sends the channels enabled by the
+	 * mask given to open, packed as libiio expects them. Offsets and sizes
+	 * given to the capture ops then count bytes of full frames, and
+	 * READBUF fails with -EINVAL for a part of a packed frame */
+	int32_t (*get_frame_layout)(const char *device,
+				    struct tinyiiod_frame_layout *layout);
+
+	/* Optional continuous capture: return the ring the device just opened
+	 * captures into until it is closed, or NULL. READBUF then sends the
+	 * data of the ring as they are produced, without gaps between
+	 * requests, instead of using the capture ops above. With a frame
+	 * layout, only whole frames must be committed and the size of the
+	 * ring must be a multiple of the frame size */
+	int32_t (*get_ring)(const char *device, struct tinyiiod_ring **ring);
+
+	/* Optional free-running counter, which can wrap around, measuring the
+	 * time spent in each command for the statistics */
+	uint32_t (*get_cycles)(void);
+
+	/* Optional monotonic clock in milliseconds, which can wrap around.
+	 * Needed for attribute TTLs other than TINYIIOD_TTL_STATIC, and for
+	 * the timeout to bound transfers: TIMEOUT is accepted without it,
+	 * but then only forwarded to set_timeout */
+	uint32_t (*get_time_ms)(void);
+
+	/* Optional: when set, the attribute accesses of READ and WRITE are
+	 * not done by the thread servicing the clients but queued for
+	 * tinyiiod_work(), to be called by a worker thread or core; the
+	 * attribute ops, show and store are then only called from there.
+	 * notify_worker is called from the servicing thread every time an
+	 * access is queued, e.g. to post a semaphore the worker waits on */
+	void (*notify_worker)(void);
+
+	/* Optional, needed with notify_worker: take and release a mutex
+	 * shared by the worker and the thread servicing the clients. It is
+	 * held while attributes are looked up and their cached values
+	 * copied, while the registry of the attributes is put in place or
+	 * taken out and while the worker takes an access from the queue,
+	 * never while another op is called, get_time_ms and the allocator
+	 * included */
+	void (*lock)(void);
+	void (*unlock)(void);
+
+	/* Optional: called in every step of a wait for the worker, the
+	 * backend or a capture ring, e.g. taskYIELD() or sched_yield(), so
+	 * that they can run when they have a lower priority. A wait lasts
+	 * the timeout of the session at most, or IIOD_WAIT_TIMEOUT ms when
+	 * the client gave none; without get_time_ms, IIOD_WAIT_STEPS calls */
+	void (*yield)(void);
+
+	/* Optional attribute access by ID, used in place of the four ops
+	 * above when set. IDs number the attributes from 0 in the order they
+	 * appear in the context XML, whatever their kind or channel;
+	 * tinyiiod_attr_id() returns the ID of a given attribute */
+	ssize_t (*read_attr_id)(uint32_t id, char *buf, size_t len);
+	ssize_t (*write_attr_id)(uint32_t id, const char *buf, size_t len);
+
+	/* Optional static description of the context, which can live in
+	 * read-only memory. When set, the context XML is generated from it
+	 * instead of being asked to get_xml, and attribute accesses go to the
+	 * show and store callbacks of the attributes instead of the ops above.
+	 * The descriptors are never copied to RAM: on the first access, a
+	 * hash table of pointers into them is allocated to look attributes
+	 * up, and they are walked by name when that fails */
+	const struct tinyiiod_context_desc *context;
+
+	/* Optional: return the length of the zstd-compressed context XML
+	 * sent in answer to ZPRINT. The data stays owned by the backend and
+	 * must remain valid until tinyiiod_invalidate_xml() or
+	 * tinyiiod_destroy() */
+	ssize_t (*get_zxml)(const char **outzxml);
+};
+
+/* Upper bound of the size of an instance, to raise when the limits of
+ * tinyiiod-private.h are raised */
+#ifndef TINYIIOD_STRUCT_SIZE
+#define TINYIIOD_STRUCT_SIZE 2560
+#endif
+
+/* Alignment of what the library carves from struct tinyiiod_config::mem */
+#define TINYIIOD_MEM_ALIGN 8
+
+/* Memory needed in struct tinyiiod_config::mem for an instance with the
+ * given sizes, see tinyiiod_mem_size() */
+#define TINYIIOD_MEM_SIZE(buf_size, rx_size, tx_size, line_size) \
+	(TINYIIOD_MEM_ALIGN * 5 + TINYIIOD_STRUCT_SIZE + (buf_size) + \
+	 (rx_size) + (tx_size) + (line_size))
+
+struct tinyiiod_allocator {
+	void * (*alloc)(void *priv, size_t size);
+	void (*free)(void *priv, void *ptr);
+	void *priv;
+};
+
+struct tinyiiod_cmd_stats {
+	uint32_t count;
+	/* Bytes of the requests, payloads included, and of the responses */
+	uint64_t bytes_in, bytes_out;
+	/* Time spent handling the commands, counted with get_cycles */
+	uint64_t cycles;
+	uint32_t max_cycles;
+};
+
+struct tinyiiod_config {
+	/* Transfer buffer used for attribute values and READBUF/WRITEBUF
+	 * chunks; allocated by the library when NULL */
+	char *buf;
+	/* Size of the transfer buffer, IIOD_BUFFER_SIZE when 0 */
+	size_t buf_size;
+	/* Size of the read-ahead buffer used with read_partial, which also
+	 * keeps what tinyiiod_feed() receives while a command is pending,
+	 * IIOD_RX_BUFFER_SIZE when 0 */
+	size_t rx_size;
+	/* Size of the buffer used to coalesce the writes of a response,
+	 * IIOD_TX_BUFFER_SIZE when 0 */
+	size_t tx_size;
+	/* Size of the blocks of pipelined transfers, buf_size when 0 */
+	size_t block_size;
+	/* Longest command line, including its \r\n, IIOD_LINE_SIZE when 0 */
+	size_t line_size;
+
+	/* Memory holding the instance and its buffers, which are allocated
+	 * when NULL; see tinyiiod_mem_size(). Without an allocator, nothing
+	 * else is allocated then: what needs the registry of the context
+	 * XML, i.e. READ of all the attributes, attribute IDs and TTLs set
+	 * with tinyiiod_set_attr_ttl(), fails with -ENOMEM. A context
+	 * descriptor is walked by name instead of looked up in its registry */
+	void *mem;
+	size_t mem_size;
+	/* Used in place of malloc() and free() when set, by the instance and
+	 * its sessions; the context XML returned by get_xml is still freed
+	 * with free() */
+	const struct tinyiiod_allocator *allocator;
+};
+
+/* Transport of a session, every call gets the priv pointer given to
+ * tinyiiod_session_create() */
+struct tinyiiod_session_ops {
+	ssize_t (*read)(void *priv, char *buf, size_t len);
+	ssize_t (*write)(void *priv, const char *buf, size_t len);
+
+	/* Optional, see tinyiiod_ops */
+	ssize_t (*writev)(void *priv, const struct tinyiiod_span *spans,
+			  unsigned int count);
+	ssize_t (*read_partial)(void *priv, char *buf, size_t len);
+	int32_t (*set_timeout)(void *priv, uint32_t timeout);
+};
+
+struct tinyiiod_command {
+	const char *name;
+	/* Called with the arguments following the command name. The handler
+	 * writes its own response; a negative return value is sent back to
+	 * the client as an error code */
+	int32_t (*handler)(struct tinyiiod *iiod, char *args);
 };
 
 struct tinyiiod * tinyiiod_create(struct tinyiiod_ops *ops);
+struct tinyiiod * tinyiiod_create_ext(struct tinyiiod_ops *ops,
+				      const struct tinyiiod_config *config);
+
+/* Create a session serving one more client with the device model of iiod.
+ * A session has its own transport, buffers, protocol mode and timeout, and
+ * a device it opened cannot be used by other sessions until it is closed.
+ * The returned instance is used with tinyiiod_read_command() and
+ * tinyiiod_destroy() like any other; all the sessions of an instance must
+ * be serviced from the same thread, the worker aside, and destroyed before
+ * it. The session takes its memory from config->mem, or else from the
+ * allocator of iiod; NULL is returned when there is neither and iiod was
+ * created in static memory, the heap being never used then. */
+struct tinyiiod * tinyiiod_session_create(struct tinyiiod *iiod,
+		const struct tinyiiod_session_ops *ops, void *priv,
+		const struct tinyiiod_config *config);
+
+/* Size of the memory needed in config->mem for an instance created with
+ * config, which can be NULL for the defaults */
+size_t tinyiiod_mem_size(const struct tinyiiod_config *config);
+
 void tinyiiod_destroy(struct tinyiiod *iiod);
 int32_t tinyiiod_read_command(struct tinyiiod *iiod);
 
+/* Non-blocking alternative to tinyiiod_read_command(), for transports
+ * delivering data from an interrupt or a callback: pass every chunk of
+ * bytes received from the client, commands run as soon as they are
+ * complete and partial ones are resumed on the next call. Responses go
+ * through the write op, which must not block. Returns the result of the
+ * last command completed, 0 when there was none. */
+int32_t tinyiiod_feed(struct tinyiiod *iiod, const char *data, size_t len);
+
+/* With ops->notify_worker: run the next attribute access queued by the
+ * sessions of iiod, from the worker. Returns 1 when one was run, 0 when the
+ * queue was empty; tinyiiod_poll() then sends its response. */
+int32_t tinyiiod_work(struct tinyiiod *iiod);
+
+/* Send the response of the command of iiod left to the worker, or completed
+ * with tinyiiod_complete(), once it is done, then run the commands
+ * tinyiiod_feed() received in the meantime, which it kept in the read-ahead
+ * buffer. Returns -EINPROGRESS while the command is still pending, otherwise
+ * as tinyiiod_feed(). tinyiiod_read_command() waits for it itself. */
+int32_t tinyiiod_poll(struct tinyiiod *iiod);
+
+/*
+ * An attribute op, or a show or store callback, that cannot answer right away
+ * can return -EINPROGRESS: the session it was called for, returned by
+ * tinyiiod_caller() during the call, then waits. The backend later completes
+ * the access with tinyiiod_complete(), from any context and possibly before
+ * the op has returned, passing what the op would have returned, after writing
+ * the value read to the buffer given to the op, which stays valid until then.
+ * Values completed this way are not cached.
+ *
+ * Only sessions serviced with tinyiiod_feed() and tinyiiod_poll() let the
+ * other sessions go on meanwhile: tinyiiod_read_command() waits for the access
+ * itself, as for the worker, returning -ETIMEDOUT once the wait took the
+ * timeout and waiting again on the next call. A session is only destroyed once
+ * its pending access is completed or the wait for it took the timeout: the
+ * backend must not complete it any more then. An access the worker is running
+ * is always waited for, and one it did not take yet is dropped.
+ */
+struct tinyiiod * tinyiiod_caller(struct tinyiiod *iiod);
+void tinyiiod_complete(struct tinyiiod *iiod, ssize_t ret);
+
+/* Drop the cached context XML, get_xml and get_zxml are called again on the
+ * next PRINT or ZPRINT */
+void tinyiiod_invalidate_xml(struct tinyiiod *iiod);
+
+/* ID of an attribute as passed to the read_attr_id and write_attr_id ops,
+ * or a negative error code; -ENOSYS with a context descriptor, which does not
+ * use them. channel is NULL for device attributes */
+int32_t tinyiiod_attr_id(struct tinyiiod *iiod, const char *device,
+			 const char *channel, bool ch_out, const char *attr,
+			 enum iio_attr_type type);
+
+/* Keep the values read from an attribute for ttl_ms milliseconds, during
+ * which READ answers from the library without calling the backend; 0 turns
+ * caching off and TINYIIOD_TTL_STATIC keeps the value until the attribute is
+ * written. Writing an attribute always drops its value. The setting is lost
+ * on tinyiiod_invalidate_xml(). With a context descriptor, the TTLs are the
+ * ttl_ms of the attributes and this fails with -ENOSYS. The values are kept
+ * in the instance, up to IIOD_CACHE_SIZE of them of at most
+ * IIOD_CACHE_VALUE_SIZE bytes each, replaced in turn */
+int32_t tinyiiod_set_attr_ttl(struct tinyiiod *iiod, const char *device,
+			      const char *channel, bool ch_out, const char *attr,
+			      enum iio_attr_type type, uint32_t ttl_ms);
+
+/* Statistics of the commands handled by an instance since its creation or
+ * the last tinyiiod_reset_stats(), also returned by the STATS command.
+ * Entry n of the *count entries is about the command tinyiiod_stats_name(n) */
+const struct tinyiiod_cmd_stats * tinyiiod_get_stats(struct tinyiiod *iiod,
+						     unsigned int *count);
+const char * tinyiiod_stats_name(unsigned int index);
+void tinyiiod_reset_stats(struct tinyiiod *iiod);
+
+/* Commands not handled by the library are looked up in this table, which
+ * must remain valid as long as the instance is used */
+void tinyiiod_register_commands(struct tinyiiod *iiod,
+				const struct tinyiiod_command *commands,
+				size_t count);
+
+ssize_t tinyiiod_write(struct tinyiiod *iiod, const char *data, size_t len);
+ssize_t tinyiiod_write_string(struct tinyiiod *iiod, const char *str);
+ssize_t tinyiiod_write_value(struct tinyiiod *iiod, int32_t value);
+ssize_t tinyiiod_writev(struct tinyiiod *iiod,
+			const struct tinyiiod_span *spans, unsigned int count);
+
+/* Producer side of a ring, callable from an interrupt: the free memory
+ * following head, *len bytes long, then the number of bytes written there */
+char * tinyiiod_ring_reserve(struct tinyiiod_ring *ring, size_t *len);
+void tinyiiod_ring_commit(struct tinyiiod_ring *ring, size_t bytes);
+
+/* Copy the len bytes of data, or count them as overflow when they do not
+ * all fit; returns len or 0 */
+size_t tinyiiod_ring_push(struct tinyiiod_ring *ring,
+			  const char *data, size_t len);
+
 #endif /* TINYIIOD_H */
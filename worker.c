@@ -0,0 +1,265 @@
+/*
+ * libtinyiiod - Tiny IIO Daemon Library
+ *
+ * Copyright (C) 2019 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "tinyiiod-private.h"
+
+#include "compat.h"
+
+/* Servicing thread side: the job of iiod was set up before */
+static bool tinyiiod_job_queue(struct tinyiiod *iiod)
+{
+	struct tinyiiod *root = iiod->root;
+	size_t head = root->job_head;
+	size_t next = (head + 1) % IIOD_JOB_QUEUE_SIZE;
+
+	if (next == root->job_tail)
+		return false;
+
+	root->jobs[head] = iiod;
+
+	/* The job must be visible before the new head */
+	TINYIIOD_RING_BARRIER();
+	root->job_head = next;
+
+	return true;
+}
+
+void tinyiiod_call(struct tinyiiod *iiod,
+		   ssize_t (*run)(struct tinyiiod *iiod),
+		   void (*done)(struct tinyiiod *iiod, ssize_t ret))
+{
+	struct tinyiiod_job *job = &iiod->job;
+	ssize_t ret = 0;
+
+	job->done = done;
+	job->complete = false;
+
+	/* The registry is built here when the access needs one: the worker
+	 * and the attribute ops only look attributes up. A context descriptor
+	 * is walked in place when there is no memory for its registry */
+	if (iiod->ops->context)
+		tinyiiod_get_registry(iiod);
+	else if (iiod->ops->read_attr_id || iiod->ops->write_attr_id ||
+		 !iiod->xfer.attr)
+		ret = tinyiiod_get_registry(iiod);
+	if (ret < 0) {
+		done(iiod, ret);
+		return;
+	}
+
+	if (!iiod->ops->notify_worker) {
+		iiod->root->caller = iiod;
+		ret = run(iiod);
+		if (ret != -EINPROGRESS) {
+			done(iiod, ret);
+			return;
+		}
+
+		/* Completed by the backend, maybe already */
+		job->queued = true;
+		iiod->state = IIOD_STATE_PENDING;
+		return;
+	}
+
+	job->run = run;
+	iiod->state = IIOD_STATE_PENDING;
+
+	/* Otherwise queued when polled */
+	job->queued = tinyiiod_job_queue(iiod);
+	if (job->queued)
+		iiod->ops->notify_worker();
+}
+
+bool tinyiiod_job_complete(struct tinyiiod *iiod)
+{
+	struct tinyiiod_job *job = &iiod->job;
+
+	if (iiod->state != IIOD_STATE_PENDING)
+		return true;
+
+	if (!job->queued) {
+		job->queued = tinyiiod_job_queue(iiod);
+		if (job->queued)
+			iiod->ops->notify_worker();
+		return false;
+	}
+
+	if (!job->complete)
+		return false;
+
+	/* The result is read after the flag telling it is there */
+	TINYIIOD_RING_BARRIER();
+	job->queued = false;
+	job->done(iiod, job->ret);
+
+	return true;
+}
+
+/* Servicing thread side, with the lock held: the worker skips the slots
+ * left empty. Returns whether a slot was dropped */
+static bool tinyiiod_job_drop(struct tinyiiod *iiod)
+{
+	struct tinyiiod *root = iiod->root;
+	bool dropped = false;
+	size_t i;
+
+	for (i = root->job_tail; i != root->job_head;
+	     i = (i + 1) % IIOD_JOB_QUEUE_SIZE) {
+		if (root->jobs[i] == iiod) {
+			root->jobs[i] = NULL;
+			dropped = true;
+		}
+	}
+
+	return dropped;
+}
+
+/* Whether the worker took the job of iiod and is not done with it yet */
+static bool tinyiiod_job_running(struct tinyiiod *iiod)
+{
+	bool running;
+
+	tinyiiod_lock(iiod);
+	running = iiod->job.running;
+	tinyiiod_unlock(iiod);
+
+	return running;
+}
+
+void tinyiiod_job_cancel(struct tinyiiod *iiod)
+{
+	struct tinyiiod_job *job = &iiod->job;
+	struct tinyiiod_wait wait;
+	bool dropped = false;
+
+	/* A job the worker did not take yet is dropped. Once taken, the
+	 * worker uses iiod until it completes the job and releases the
+	 * lock, which is waited for however long it takes, even when the
+	 * result was seen already */
+	tinyiiod_lock(iiod);
+	if (!job->running && iiod->state == IIOD_STATE_PENDING)
+		dropped = tinyiiod_job_drop(iiod);
+	tinyiiod_unlock(iiod);
+
+	while (tinyiiod_job_running(iiod)) {
+		if (iiod->ops->yield)
+			iiod->ops->yield();
+	}
+
+	if (iiod->state != IIOD_STATE_PENDING)
+		return;
+
+	/* The backend may still complete an access left -EINPROGRESS */
+	tinyiiod_wait_start(iiod, &wait);
+	while (!dropped && job->queued && !job->complete) {
+		if (!tinyiiod_wait_step(iiod, &wait))
+			break;
+	}
+
+	job->queued = false;
+	iiod->state = IIOD_STATE_LINE;
+}
+
+int32_t tinyiiod_work(struct tinyiiod *iiod)
+{
+	struct tinyiiod *root = iiod->root;
+	size_t tail = root->job_tail;
+	struct tinyiiod *session;
+	ssize_t ret;
+
+	if (tail == root->job_head)
+		return 0;
+
+	/* The job is read after the head telling it is there, and taken
+	 * with the lock held: a session being destroyed either dropped it
+	 * before or waits for it to be done */
+	TINYIIOD_RING_BARRIER();
+	tinyiiod_lock(iiod);
+	session = root->jobs[tail];
+	if (session)
+		session->job.running = true;
+	tinyiiod_unlock(iiod);
+
+	/* Dropped by a session destroyed meanwhile */
+	if (session) {
+		root->caller = session;
+		ret = session->job.run(session);
+	}
+
+	/* The slot must have been read before it is reused, and be free
+	 * before the session can queue again */
+	TINYIIOD_RING_BARRIER();
+	root->job_tail = (tail + 1) % IIOD_JOB_QUEUE_SIZE;
+
+	/* The session can be destroyed as soon as the lock is released */
+	if (session) {
+		tinyiiod_lock(iiod);
+		if (ret != -EINPROGRESS)
+			tinyiiod_complete(session, ret);
+		session->job.running = false;
+		tinyiiod_unlock(iiod);
+	}
+
+	return 1;
+}
+
+struct tinyiiod * tinyiiod_caller(struct tinyiiod *iiod)
+{
+	return iiod->root->caller;
+}
+
+void tinyiiod_complete(struct tinyiiod *iiod, ssize_t ret)
+{
+	iiod->job.ret = ret;
+
+	/* The result, and the value given to the op, must be visible
+	 * before the flag */
+	TINYIIOD_RING_BARRIER();
+	iiod->job.complete = true;
+}
+
+void tinyiiod_lock(struct tinyiiod *iiod)
+{
+	if (iiod->ops->lock)
+		iiod->ops->lock();
+}
+
+void tinyiiod_unlock(struct tinyiiod *iiod)
+{
+	if (iiod->ops->unlock)
+		iiod->ops->unlock();
+}
+
+void tinyiiod_wait_start(struct tinyiiod *iiod, struct tinyiiod_wait *wait)
+{
+	wait->start = 0;
+	wait->steps = 0;
+	if (iiod->ops->get_time_ms)
+		wait->start = iiod->ops->get_time_ms();
+}
+
+bool tinyiiod_wait_step(struct tinyiiod *iiod, struct tinyiiod_wait *wait)
+{
+	uint32_t timeout = iiod->timeout ? iiod->timeout : IIOD_WAIT_TIMEOUT;
+
+	if (iiod->ops->yield)
+		iiod->ops->yield();
+
+	if (iiod->ops->get_time_ms)
+		return iiod->ops->get_time_ms() - wait->start < timeout;
+
+	return ++wait->steps < IIOD_WAIT_STEPS;
+}